@@ -0,0 +1,25 @@
+#include "cancellation_token.h"
+
+TCancellationToken::TCancellationToken(): Cancelled(false)
+{}
+
+void TCancellationToken::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lg(Mutex);
+        Cancelled = true;
+    }
+    CV.notify_all();
+}
+
+bool TCancellationToken::IsCancelled() const
+{
+    std::lock_guard<std::mutex> lg(Mutex);
+    return Cancelled;
+}
+
+bool TCancellationToken::WaitUntil(std::chrono::steady_clock::time_point timePoint) const
+{
+    std::unique_lock<std::mutex> lk(Mutex);
+    return CV.wait_until(lk, timePoint, [this] { return Cancelled; });
+}
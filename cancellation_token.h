@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * @brief The class is used to stop long running operations from another thread
+ *
+ */
+class TCancellationToken
+{
+public:
+    TCancellationToken();
+
+    /**
+     * @brief Request cancellation and wake up all threads waiting in WaitUntil
+     */
+    void Cancel();
+
+    bool IsCancelled() const;
+
+    /**
+     * @brief Sleep until the time point or until cancellation
+     *
+     * @return true - cancellation is requested
+     * @return false - the time point is reached
+     */
+    bool WaitUntil(std::chrono::steady_clock::time_point timePoint) const;
+
+private:
+    mutable std::mutex Mutex;
+    mutable std::condition_variable CV;
+    bool Cancelled;
+};
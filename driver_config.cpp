@@ -0,0 +1,145 @@
+#include "driver_config.h"
+
+#include "file_utils.h"
+#include <jsoncpp/json/json.h>
+
+using namespace std;
+
+namespace
+{
+    [[noreturn]] void ThrowConfigError(const string& fileName, const string& message)
+    {
+        throw runtime_error("Bad config " + fileName + ": " + message);
+    }
+
+    const Json::Value* GetMember(const Json::Value& root,
+                                 const string& fileName,
+                                 const string& name,
+                                 bool (Json::Value::*isValidType)() const,
+                                 const char* typeName)
+    {
+        if (!root.isMember(name)) {
+            return nullptr;
+        }
+        const auto& value = root[name];
+        if (!(value.*isValidType)()) {
+            ThrowConfigError(fileName, "'" + name + "' must be " + typeName);
+        }
+        return &value;
+    }
+
+    void LoadMilliseconds(const Json::Value& root,
+                          const string& fileName,
+                          const string& name,
+                          chrono::milliseconds& value)
+    {
+        auto member = GetMember(root, fileName, name, &Json::Value::isUInt, "non-negative integer");
+        if (member) {
+            value = chrono::milliseconds(member->asUInt());
+        }
+    }
+
+    void LoadBool(const Json::Value& root, const string& fileName, const string& name, bool& value)
+    {
+        auto member = GetMember(root, fileName, name, &Json::Value::isBool, "boolean");
+        if (member) {
+            value = member->asBool();
+        }
+    }
+
+    optional<double> LoadLimit(const Json::Value& threshold, const string& fileName, const string& name)
+    {
+        auto member = GetMember(threshold, fileName, name, &Json::Value::isNumeric, "number");
+        if (member) {
+            return member->asDouble();
+        }
+        return nullopt;
+    }
+
+    void LoadPriorities(const Json::Value& root, const string& fileName, TOneWireDriverSettings& settings)
+    {
+        auto priorities = GetMember(root, fileName, "priorities", &Json::Value::isObject, "object");
+        if (!priorities) {
+            return;
+        }
+        settings.Priorities.clear();
+        for (const auto& id: priorities->getMemberNames()) {
+            GetMember(*priorities, fileName, id, &Json::Value::isInt, "integer");
+            settings.Priorities[id] = (*priorities)[id].asInt();
+        }
+    }
+
+    void LoadThresholds(const Json::Value& root, const string& fileName, TOneWireDriverSettings& settings)
+    {
+        auto thresholds = GetMember(root, fileName, "thresholds", &Json::Value::isArray, "array");
+        if (!thresholds) {
+            return;
+        }
+        settings.Thresholds.clear();
+        for (const auto& item: *thresholds) {
+            if (!item.isObject()) {
+                ThrowConfigError(fileName, "'thresholds' items must be objects");
+            }
+            auto id = GetMember(item, fileName, "id", &Json::Value::isString, "string");
+            if (!id) {
+                ThrowConfigError(fileName, "'thresholds' item must have 'id'");
+            }
+            TThresholds value;
+            value.Low = LoadLimit(item, fileName, "low");
+            value.High = LoadLimit(item, fileName, "high");
+            auto hysteresis = LoadLimit(item, fileName, "hysteresis");
+            if (hysteresis) {
+                value.Hysteresis = *hysteresis;
+            }
+            settings.Thresholds[id->asString()] = value;
+        }
+    }
+}
+
+void LoadDriverConfig(const string& fileName, TOneWireDriverSettings& settings)
+{
+    ifstream file;
+    OpenWithException(file, fileName);
+    Json::CharReaderBuilder readerBuilder;
+    Json::Value root;
+    string errors;
+    if (!Json::parseFromStream(readerBuilder, file, &root, &errors)) {
+        ThrowConfigError(fileName, errors);
+    }
+    if (!root.isObject()) {
+        ThrowConfigError(fileName, "root must be an object");
+    }
+
+    LoadMilliseconds(root, fileName, "poll_interval_ms", settings.PollInterval);
+    LoadMilliseconds(root, fileName, "fast_poll_interval_ms", settings.FastPollInterval);
+    LoadBool(root, fileName, "read_commands", settings.ReadCommands);
+    LoadBool(root, fileName, "explicit_search", settings.ExplicitSearch);
+    LoadBool(root, fileName, "batch_read", settings.BatchRead);
+    LoadBool(root, fileName, "sample_times", settings.SampleTimes);
+    LoadBool(root, fileName, "synchronized_conversion", settings.SynchronizedConversion);
+
+    auto aggregationWindow =
+        GetMember(root, fileName, "aggregation_window", &Json::Value::isUInt, "non-negative integer");
+    if (aggregationWindow) {
+        settings.AggregationWindow = aggregationWindow->asUInt();
+    }
+    auto errorLogPeriod =
+        GetMember(root, fileName, "error_log_period_s", &Json::Value::isUInt, "non-negative integer");
+    if (errorLogPeriod) {
+        settings.ErrorLogPeriod = chrono::seconds(errorLogPeriod->asUInt());
+    }
+
+    auto sensors = GetMember(root, fileName, "sensors", &Json::Value::isArray, "array");
+    if (sensors) {
+        settings.Filter.SensorIds.clear();
+        for (const auto& pattern: *sensors) {
+            if (!pattern.isString()) {
+                ThrowConfigError(fileName, "'sensors' items must be strings");
+            }
+            settings.Filter.SensorIds.push_back(pattern.asString());
+        }
+    }
+
+    LoadThresholds(root, fileName, settings);
+    LoadPriorities(root, fileName, settings);
+}
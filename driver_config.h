@@ -0,0 +1,30 @@
+#pragma once
+
+#include "onewire_driver.h"
+
+#include <string>
+
+/**
+ * @brief Load driver settings from JSON config file on top of given settings.
+ *        Parameters absent in the file are left unchanged, so command line options act as defaults.
+ *        Throws std::runtime_error if the file can't be read or has wrong format.
+ *
+ *        Supported parameters:
+ *          poll_interval_ms        - polling interval, ms
+ *          aggregation_window      - number of polling cycles for min/max/mean statistics, 0 - disabled
+ *          fast_poll_interval_ms   - polling interval of buses with thermometers in alarm state, ms
+ *          read_commands           - create <id>_read pushbuttons
+ *          error_log_period_s      - period of repeated read errors logging, s
+ *          explicit_search         - stop kernel background search
+ *          batch_read              - read thermometers in one batch, same as -U option. io_uring backend is
+ *                                    created on start only, so enabling it by reload uses plain system calls
+ *          sample_times            - publish <id>_sample_time and <id>_latency controls
+ *          synchronized_conversion - trigger conversions on all buses together
+ *          sensors                 - array of wildcard patterns of handled thermometers
+ *          thresholds              - array of objects {"id", "low", "high", "hysteresis"}, replaces all thresholds
+ *          priorities              - object {"id": priority} of thermometers' priorities, replaces all priorities
+ *
+ * @param fileName config file
+ * @param settings settings to update
+ */
+void LoadDriverConfig(const std::string& fileName, TOneWireDriverSettings& settings);
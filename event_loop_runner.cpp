@@ -0,0 +1,183 @@
+#include "event_loop_runner.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <wblib/utils.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace WBMQTT;
+
+namespace
+{
+    const int MAX_EVENTS = 16;
+
+    [[noreturn]] void ThrowSystemError(const char* what)
+    {
+        throw system_error(errno, generic_category(), what);
+    }
+
+    /**
+     * @brief Arm a timer to a steady_clock time point, timerfd uses CLOCK_MONOTONIC as steady_clock does
+     */
+    void ArmAt(int timerFd, steady_clock::time_point timePoint)
+    {
+        auto ns = duration_cast<nanoseconds>(timePoint.time_since_epoch()).count();
+        itimerspec spec{};
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+
+        // Zero value disarms the timer
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void ArmNow(int timerFd)
+    {
+        itimerspec spec{};
+        spec.it_value.tv_nsec = 1;
+        timerfd_settime(timerFd, 0, &spec, nullptr);
+    }
+
+    void AddToEpoll(int epollFd, int fd, void* data)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = data;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ThrowSystemError("epoll_ctl failed");
+        }
+    }
+}
+
+TEventLoopRunner::TEventLoopRunner(vector<TTask> tasks, const string& threadName, TLogger& logger)
+    : EpollFd(-1),
+      StopFd(-1),
+      Active(true)
+{
+    for (const auto& task: tasks) {
+        if (task.PollInterval.count() < 1) {
+            throw invalid_argument("polling intervall must be greater than zero");
+        }
+    }
+    try {
+        EpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (EpollFd < 0) {
+            ThrowSystemError("epoll_create1 failed");
+        }
+        StopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (StopFd < 0) {
+            ThrowSystemError("eventfd failed");
+        }
+        AddToEpoll(EpollFd, StopFd, nullptr);
+        for (auto& task: tasks) {
+            auto timer = make_unique<TWorkerTimer>();
+            timer->Task = move(task);
+            timer->TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+            if (timer->TimerFd < 0) {
+                ThrowSystemError("timerfd_create failed");
+            }
+            Timers.push_back(move(timer));
+            AddToEpoll(EpollFd, Timers.back()->TimerFd, Timers.back().get());
+        }
+    } catch (...) {
+        CloseFds();
+        throw;
+    }
+
+    for (auto& timer: Timers) {
+        auto t = timer.get();
+        t->Task.Worker->SetWakeUpHandler([this, t] { WakeUp(*t); });
+        ArmNow(t->TimerFd);
+    }
+    WorkerThread = MakeThread(threadName, {[this, threadName, &logger] {
+                                  logger.Log() << threadName << " Started";
+                                  Run();
+                                  logger.Log() << threadName << " Stopped";
+                              }});
+}
+
+TEventLoopRunner::~TEventLoopRunner()
+{
+    Active = false;
+    for (auto& timer: Timers) {
+        timer->Task.Worker->Cancel();
+    }
+    uint64_t value = 1;
+    if (write(StopFd, &value, sizeof(value)) < 0) {
+        // The counter can't overflow with single write, so it never happens
+    }
+    if (WorkerThread->joinable()) {
+        WorkerThread->join();
+    }
+    WorkerThread.reset();
+
+    // Workers can call WakeUp until they are destroyed
+    for (auto& timer: Timers) {
+        timer->Task.Worker.reset();
+    }
+    CloseFds();
+}
+
+void TEventLoopRunner::CloseFds()
+{
+    for (auto& timer: Timers) {
+        close(timer->TimerFd);
+    }
+    if (StopFd >= 0) {
+        close(StopFd);
+    }
+    if (EpollFd >= 0) {
+        close(EpollFd);
+    }
+}
+
+void TEventLoopRunner::Run()
+{
+    epoll_event events[MAX_EVENTS];
+    while (Active) {
+        auto count = epoll_wait(EpollFd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw system_error(errno, generic_category(), "epoll_wait failed");
+        }
+        for (int i = 0; i < count && Active; ++i) {
+            if (events[i].data.ptr) {
+                RunWorker(*static_cast<TWorkerTimer*>(events[i].data.ptr));
+            }
+        }
+    }
+}
+
+void TEventLoopRunner::RunWorker(TWorkerTimer& timer)
+{
+    uint64_t expirations;
+    if (read(timer.TimerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        // The timer is rearmed after the event was reported
+        return;
+    }
+    timer.WakeUpRequested = false;
+    timer.Task.Worker->RunIteration();
+    auto delay = timer.Task.Worker->GetNextIterationDelay(timer.Task.PollInterval);
+    ArmAt(timer.TimerFd, steady_clock::now() + delay);
+
+    // WakeUp could be called during RunIteration, its timer setting is overwritten above
+    if (timer.WakeUpRequested) {
+        ArmNow(timer.TimerFd);
+    }
+}
+
+void TEventLoopRunner::WakeUp(TWorkerTimer& timer)
+{
+    timer.WakeUpRequested = true;
+    ArmNow(timer.TimerFd);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "threaded_runner.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The class executes RunIteration methods of several IPeriodicalWorker objects in one thread.
+ *        Every worker has its own timerfd armed to an absolute deadline, the thread sleeps in epoll_wait
+ *        and wakes up only when a deadline of some worker is reached, on wake up request or on stop.
+ *        Workers are executed one by one, so a long RunIteration call delays other workers. A worker should
+ *        return from RunIteration while it waits and continue on next call, see IPeriodicalWorker::RunIteration.
+ *
+ */
+class TEventLoopRunner
+{
+public:
+    struct TTask
+    {
+        std::unique_ptr<IPeriodicalWorker> Worker;
+
+        //! Execution interval of the worker
+        std::chrono::milliseconds PollInterval;
+    };
+
+    /**
+     * @brief Construct a new TEventLoopRunner object and start execution of workers.
+     *        Throws std::system_error if epoll or timerfd can't be created.
+     *
+     * @param tasks workers with their execution intervals
+     * @param threadName Name for execution thread
+     * @param logger logger object for information messages
+     */
+    TEventLoopRunner(std::vector<TTask> tasks, const std::string& threadName, WBMQTT::TLogger& logger);
+    ~TEventLoopRunner();
+
+    TEventLoopRunner(const TEventLoopRunner&) = delete;
+    TEventLoopRunner& operator=(const TEventLoopRunner&) = delete;
+
+private:
+    struct TWorkerTimer
+    {
+        TTask Task;
+        int TimerFd = -1;
+        std::atomic<bool> WakeUpRequested{false};
+    };
+
+    void Run();
+    void RunWorker(TWorkerTimer& timer);
+    void WakeUp(TWorkerTimer& timer);
+    void CloseFds();
+
+    std::vector<std::unique_ptr<TWorkerTimer>> Timers;
+    int EpollFd;
+    int StopFd;
+    std::atomic<bool> Active;
+    std::unique_ptr<std::thread> WorkerThread;
+};
@@ -0,0 +1,55 @@
+#include "latency_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std::chrono;
+
+void TLatencyStatistics::AddSample(microseconds latency)
+{
+    Samples.push_back(latency);
+    Sorted = false;
+}
+
+size_t TLatencyStatistics::GetCount() const
+{
+    return Samples.size();
+}
+
+microseconds TLatencyStatistics::GetPercentile(double percentile) const
+{
+    if (percentile < 0 || percentile > 100) {
+        throw std::invalid_argument("percentile must be in range [0, 100]");
+    }
+    if (Samples.empty()) {
+        return microseconds::zero();
+    }
+    if (!Sorted) {
+        std::sort(Samples.begin(), Samples.end());
+        Sorted = true;
+    }
+    // Nearest-rank: the smallest sample such that at least percentile % of samples are less or equal to it
+    auto rank = static_cast<size_t>(std::ceil(percentile / 100 * Samples.size()));
+    return Samples[std::max<size_t>(rank, 1) - 1];
+}
+
+microseconds TLatencyStatistics::GetMean() const
+{
+    if (Samples.empty()) {
+        return microseconds::zero();
+    }
+    microseconds sum = microseconds::zero();
+    for (const auto& sample: Samples) {
+        sum += sample;
+    }
+    return sum / Samples.size();
+}
+
+microseconds TLatencyStatistics::GetMax() const
+{
+    if (Samples.empty()) {
+        return microseconds::zero();
+    }
+    return *std::max_element(Samples.begin(), Samples.end());
+}
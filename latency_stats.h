@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Collection of latency samples with percentiles calculation.
+ *        All samples are stored, so the class is intended for benchmarking tools, not for the driver.
+ *
+ */
+class TLatencyStatistics
+{
+public:
+    void AddSample(std::chrono::microseconds latency);
+
+    size_t GetCount() const;
+
+    /**
+     * @brief Get latency percentile calculated by nearest-rank method
+     *
+     * @param percentile percentile in range [0, 100], e.g. 99 for 99th percentile
+     * @return percentile value or zero if there are no samples
+     */
+    std::chrono::microseconds GetPercentile(double percentile) const;
+
+    /**
+     * @brief Get arithmetic mean of samples, zero if there are no samples
+     */
+    std::chrono::microseconds GetMean() const;
+
+    /**
+     * @brief Get maximum sample, zero if there are no samples
+     */
+    std::chrono::microseconds GetMax() const;
+
+private:
+    //! Samples are sorted on first percentile request after adding
+    mutable std::vector<std::chrono::microseconds> Samples;
+    mutable bool Sorted = true;
+};
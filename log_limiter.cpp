@@ -0,0 +1,50 @@
+#include "log_limiter.h"
+
+TLogRateLimiter::TLogRateLimiter(std::chrono::steady_clock::duration period): Period(period)
+{}
+
+bool TLogRateLimiter::Report(std::string_view source, int kind, std::chrono::steady_clock::time_point now)
+{
+    auto it = States.find(std::pair<std::string_view, int>(source, kind));
+    if (it == States.end()) {
+        States.emplace(TKey(source, kind), TState{now});
+        return true;
+    }
+    auto& state = it->second;
+    if (state.Suppressed == 0 && (state.PeriodStart + Period <= now)) {
+        state.PeriodStart = now;
+        return true;
+    }
+    ++state.Suppressed;
+    return false;
+}
+
+void TLogRateLimiter::Flush(const std::function<void(const std::string& source, int kind, size_t count)>& summary,
+                            std::chrono::steady_clock::time_point now)
+{
+    for (auto it = States.begin(); it != States.end();) {
+        auto& state = it->second;
+        if (state.PeriodStart + Period > now) {
+            ++it;
+            continue;
+        }
+        if (state.Suppressed == 0) {
+            it = States.erase(it);
+            continue;
+        }
+        summary(it->first.first, it->first.second, state.Suppressed);
+        state.PeriodStart = now;
+        state.Suppressed = 0;
+        ++it;
+    }
+}
+
+std::chrono::steady_clock::duration TLogRateLimiter::GetPeriod() const
+{
+    return Period;
+}
+
+void TLogRateLimiter::SetPeriod(std::chrono::steady_clock::duration period)
+{
+    Period = period;
+}
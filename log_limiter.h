@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief The class suppresses repeated log messages of the same kind from the same source.
+ *        First message is logged, repetitions during the period are only counted and reported by a summary.
+ *
+ */
+class TLogRateLimiter
+{
+public:
+    /**
+     * @brief Construct a new TLogRateLimiter object
+     *
+     * @param period suppression period, 0 - all messages are logged
+     */
+    explicit TLogRateLimiter(std::chrono::steady_clock::duration period);
+
+    /**
+     * @brief Register a message
+     *
+     * @param source message source, e.g. thermometer's identifier code.
+     *        Known sources are found without copying, so repeated messages don't allocate memory
+     * @param kind message kind
+     * @return true - the message should be logged
+     * @return false - the message is suppressed
+     */
+    bool Report(std::string_view source,
+                int kind,
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    /**
+     * @brief Call summary function for every source and kind with suppressed messages if its period has expired
+     *
+     * @param summary function to log the summary, count is a number of suppressed messages
+     */
+    void Flush(const std::function<void(const std::string& source, int kind, size_t count)>& summary,
+               std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    std::chrono::steady_clock::duration GetPeriod() const;
+
+    /**
+     * @brief Change suppression period. It is applied to periods started after the call.
+     */
+    void SetPeriod(std::chrono::steady_clock::duration period);
+
+private:
+    struct TState
+    {
+        std::chrono::steady_clock::time_point PeriodStart;
+        size_t Suppressed = 0;
+    };
+
+    typedef std::pair<std::string, int> TKey;
+
+    //! Compares keys with std::pair<std::string_view, int> for lookups without building a key
+    struct TKeyLess
+    {
+        using is_transparent = void;
+
+        template<class T1, class T2> bool operator()(const T1& k1, const T2& k2) const
+        {
+            return std::pair<std::string_view, int>(k1.first, k1.second) <
+                   std::pair<std::string_view, int>(k2.first, k2.second);
+        }
+    };
+
+    std::chrono::steady_clock::duration Period;
+    std::map<TKey, TState, TKeyLess> States;
+};
@@ -1,6 +1,12 @@
 #include <getopt.h>
+#include <mutex>
+#include <sstream>
 
+#include "driver_config.h"
+#include "event_loop_runner.h"
 #include "onewire_driver.h"
+#include "sysfs_io_uring.h"
+#include "sysfs_trace.h"
 #include "threaded_runner.h"
 #include <wblib/signal_handling.h>
 #include <wblib/utils.h>
@@ -18,9 +24,94 @@ const auto WBMQTT_DB_FILE = "/var/lib/wb-mqtt-w1/libwbmqtt.db";
 const auto W1_DRIVER_INIT_TIMEOUT_S = chrono::seconds(5);
 const auto W1_DRIVER_STOP_TIMEOUT_S = chrono::seconds(5); // topic cleanup can take a lot of time
 const uint32_t DEFAULT_POLL_INTERVALL_MS = 10000;
+const auto DEFAULT_DEVICE_ID = "wb-w1";
+const size_t DEFAULT_SHM_EXPORT_CAPACITY = 256;
 
 namespace
 {
+    //! Bus masters handled by a separate worker thread
+    struct TShardSettings
+    {
+        std::vector<std::string> BusMasters;
+
+        //! Polling interval of the shard, ms, 0 - common polling interval
+        uint32_t PollInterval = 0;
+    };
+
+    TOneWireDriverSettings MakeShardSettings(const TOneWireDriverSettings& settings, const TShardSettings& shard)
+    {
+        auto shardSettings = settings;
+        shardSettings.Filter.BusMasters = shard.BusMasters;
+        if (shard.PollInterval) {
+            shardSettings.PollInterval = chrono::milliseconds(shard.PollInterval);
+        }
+        return shardSettings;
+    }
+
+    //! Reloads config file and passes new settings to running workers
+    class TConfigReloader
+    {
+    public:
+        /**
+         * @brief Set config file and settings from command line, config file is applied on top of them
+         */
+        void Init(const string& configFile,
+                  const TOneWireDriverSettings& commandLineSettings,
+                  const vector<TShardSettings>& shards)
+        {
+            lock_guard<mutex> lg(Mutex);
+            ConfigFile = configFile;
+            CommandLineSettings = commandLineSettings;
+            Shards = shards;
+        }
+
+        /**
+         * @brief Set workers to update in order of shards, empty vector - stop updating
+         */
+        void SetWorkers(const vector<TOneWireDriverWorker*>& workers)
+        {
+            lock_guard<mutex> lg(Mutex);
+            Workers = workers;
+        }
+
+        void Reload()
+        {
+            lock_guard<mutex> lg(Mutex);
+            if (ConfigFile.empty()) {
+                LOG(Info) << "Config file is not set, nothing to reload";
+                return;
+            }
+            auto settings = CommandLineSettings;
+            try {
+                LoadDriverConfig(ConfigFile, settings);
+            } catch (const exception& e) {
+                LOG(Error) << e.what() << ", settings are not changed";
+                return;
+            }
+            LOG(Info) << "Reload " << ConfigFile;
+            for (size_t i = 0; i < Workers.size(); ++i) {
+                Workers[i]->UpdateSettings(MakeShardSettings(settings, Shards[i]));
+            }
+        }
+
+    private:
+        mutex Mutex;
+        string ConfigFile;
+        TOneWireDriverSettings CommandLineSettings;
+        vector<TShardSettings> Shards;
+        vector<TOneWireDriverWorker*> Workers;
+    };
+
+    PSysfsBackend CreateBatchReadBackend()
+    {
+        try {
+            return make_shared<TIoUringSysfsBackend>();
+        } catch (const exception& e) {
+            LOG(Info) << "io_uring is not available, plain system calls are used: " << e.what();
+        }
+        return nullptr;
+    }
+
     void PrintUsage()
     {
         cout << "Usage:" << endl
@@ -35,15 +126,167 @@ namespace
              << "  -h IP        MQTT broker IP (default: localhost)" << endl
              << "  -u user      MQTT user (optional)" << endl
              << "  -P password  MQTT user password (optional)" << endl
-             << "  -i interval  polling interval, ms (default: " << DEFAULT_POLL_INTERVALL_MS << " ms)" << endl;
+             << "  -C id        MQTT client id (default: " << DEFAULT_DEVICE_ID << ")" << endl
+             << "  -D id        MQTT device id (default: " << DEFAULT_DEVICE_ID << ")" << endl
+             << "  -b patterns[:interval]" << endl
+             << "               handle only bus masters matching comma separated wildcard patterns" << endl
+             << "               in a separate thread with its own polling interval, ms" << endl
+             << "               (e.g. -b 'w1_bus_master[12]:5000'). The option can be repeated," << endl
+             << "               every shard gets MQTT device id <id>-N in this case" << endl
+             << "  -E           run all shards in one thread with epoll/timerfd event loop, the thread wakes up" << endl
+             << "               only when polling of some shard is due" << endl
+             << "  -s patterns  handle only thermometers matching comma separated wildcard patterns" << endl
+             << "               (e.g. -s '28-0000*')" << endl
+             << "  -i interval  polling interval, ms (default: " << DEFAULT_POLL_INTERVALL_MS << " ms)" << endl
+             << "  -a cycles    publish min/max/mean of values over last 'cycles' polling cycles" << endl
+             << "               every 'cycles' polling cycles (default: 0 - disabled)" << endl
+             << "  -t id:low:high[:hysteresis]" << endl
+             << "               alarm thresholds of a thermometer, low or high limit can be empty," << endl
+             << "               the option can be repeated (e.g. -t 28-00000a013d97::60:0.5)" << endl
+             << "  -o id:priority" << endl
+             << "               priority of a thermometer, thermometers with higher priority are read" << endl
+             << "               and published first in a polling cycle (default: 0)," << endl
+             << "               the option can be repeated (e.g. -o 28-00000a013d97:10)" << endl
+             << "  -f interval  polling interval of buses with thermometers in alarm state, ms" << endl
+             << "               (default: 0 - poll as usual)" << endl
+             << "  -r           create <id>_read pushbuttons for immediate reading of thermometers" << endl
+             << "  -e period    log repeated read errors of a thermometer once per period with a summary, s" << endl
+             << "               (default: 60 s, 0 - log every error)" << endl
+             << "  -k           stop kernel background search of devices and search once per polling cycle" << endl
+             << "               between conversions" << endl
+             << "  -U           read all thermometers of a polling cycle in one batch using io_uring" << endl
+             << "               (plain system calls are used if io_uring is not supported by the kernel)" << endl
+             << "  -S           trigger conversions on all buses together after devices discovery" << endl
+             << "               and publish the trigger window as trigger_skew control, us" << endl
+             << "  -T           publish <id>_sample_time (conversion completion time, Unix time in ms)" << endl
+             << "               and <id>_latency (time from conversion completion to publication, ms) controls" << endl
+             << "  -M file[:capacity]" << endl
+             << "               export latest values of thermometers to shared memory file for local consumers" << endl
+             << "               (e.g. -M /dev/shm/wb-mqtt-w1), the layout is described in w1_shm.h," << endl
+             << "               capacity is maximum number of records (default: " << DEFAULT_SHM_EXPORT_CAPACITY
+             << ")" << endl
+             << "  -c file      JSON config file, it is applied on top of command line options" << endl
+             << "               and reloaded on SIGHUP or reload_config pushbutton without restart" << endl
+             << "  -R file      record sysfs traffic to a trace file" << endl
+             << "  -Y file[:speed]" << endl
+             << "               replay sysfs traffic from a trace file recorded with -R instead of reading sysfs," << endl
+             << "               speed scales recorded timings (default: 1, 0 - no delays)" << endl;
+    }
+
+    vector<string> Split(const string& str, char delimiter)
+    {
+        vector<string> fields;
+        stringstream ss(str);
+        string field;
+        while (getline(ss, field, delimiter)) {
+            fields.push_back(field);
+        }
+        return fields;
+    }
+
+    void ParseThresholds(const string& arg, TOneWireDriverSettings& driverSettings)
+    {
+        auto fields = Split(arg, ':');
+        if (fields.size() < 3 || fields.size() > 4 || fields[0].empty()) {
+            throw invalid_argument("invalid thresholds: " + arg);
+        }
+        TThresholds thresholds;
+        if (!fields[1].empty()) {
+            thresholds.Low = stod(fields[1]);
+        }
+        if (!fields[2].empty()) {
+            thresholds.High = stod(fields[2]);
+        }
+        if (fields.size() == 4) {
+            thresholds.Hysteresis = stod(fields[3]);
+        }
+        driverSettings.Thresholds[fields[0]] = thresholds;
+    }
+
+    void ParsePriority(const string& arg, TOneWireDriverSettings& driverSettings)
+    {
+        auto pos = arg.rfind(':');
+        if (pos == string::npos || pos == 0) {
+            throw invalid_argument("invalid priority: " + arg);
+        }
+        size_t end;
+        auto priority = stoi(arg.substr(pos + 1), &end);
+        if (end != arg.size() - pos - 1) {
+            throw invalid_argument("invalid priority: " + arg);
+        }
+        driverSettings.Priorities[arg.substr(0, pos)] = priority;
+    }
+
+    TShardSettings ParseShard(const string& arg)
+    {
+        TShardSettings shard;
+        auto patterns = arg;
+        auto pos = arg.rfind(':');
+        if (pos != string::npos) {
+            patterns = arg.substr(0, pos);
+            shard.PollInterval = stoul(arg.substr(pos + 1));
+        }
+        shard.BusMasters = Split(patterns, ',');
+        if (shard.BusMasters.empty()) {
+            throw invalid_argument("invalid bus masters: " + arg);
+        }
+        return shard;
     }
 
-    void ParseCommadLine(int argc, char* argv[], WBMQTT::TMosquittoMqttConfig& mqttConfig, uint32_t& pollingInterval)
+    PSysfsBackend CreateReplayBackend(const string& arg)
+    {
+        auto speed = 1.0;
+        auto fileName = arg;
+        auto pos = arg.rfind(':');
+        if (pos != string::npos) {
+            fileName = arg.substr(0, pos);
+            speed = stod(arg.substr(pos + 1));
+            if (speed < 0) {
+                throw invalid_argument("invalid replay speed: " + arg);
+            }
+        }
+        return make_shared<TReplaySysfsBackend>(fileName, speed);
+    }
+
+    void ParseShmExport(const string& arg, string& fileName, size_t& capacity)
+    {
+        capacity = DEFAULT_SHM_EXPORT_CAPACITY;
+        fileName = arg;
+        auto pos = arg.rfind(':');
+        if (pos != string::npos) {
+            fileName = arg.substr(0, pos);
+            auto value = arg.substr(pos + 1);
+            // stoul accepts signs and spaces and throws on overflow, strtoull saturates to ULLONG_MAX instead
+            auto parsed = value.find_first_not_of("0123456789") == string::npos ? strtoull(value.c_str(), nullptr, 10)
+                                                                                 : 0;
+            if (parsed == 0 || parsed > TShmExport::GetMaxCapacity()) {
+                throw invalid_argument("invalid shared memory capacity: " + arg + ", it must be from 1 to " +
+                                       to_string(TShmExport::GetMaxCapacity()));
+            }
+            capacity = parsed;
+        }
+        if (fileName.empty()) {
+            throw invalid_argument("invalid shared memory file: " + arg);
+        }
+    }
+
+    void ParseCommadLine(int argc,
+                         char* argv[],
+                         WBMQTT::TMosquittoMqttConfig& mqttConfig,
+                         uint32_t& pollingInterval,
+                         TOneWireDriverSettings& driverSettings,
+                         string& deviceId,
+                         vector<TShardSettings>& shards,
+                         bool& eventLoop,
+                         string& configFile,
+                         string& recordFile)
     {
         int debugLevel = 0;
         int c;
+        string shmExportFile;
+        size_t shmExportCapacity = DEFAULT_SHM_EXPORT_CAPACITY;
 
-        while ((c = getopt(argc, argv, "d:i:h:p:u:P:")) != -1) {
+        while ((c = getopt(argc, argv, "d:i:h:p:u:P:a:t:o:f:re:R:Y:C:D:b:Es:kUSc:TM:")) != -1) {
             switch (c) {
                 case 'd':
                     debugLevel = stoi(optarg);
@@ -63,6 +306,92 @@ namespace
                 case 'P':
                     mqttConfig.Password = optarg;
                     break;
+                case 'a':
+                    driverSettings.AggregationWindow = stoul(optarg);
+                    break;
+                case 't':
+                    try {
+                        ParseThresholds(optarg, driverSettings);
+                    } catch (const exception& e) {
+                        cout << e.what() << endl;
+                        PrintUsage();
+                        exit(2);
+                    }
+                    break;
+                case 'o':
+                    try {
+                        ParsePriority(optarg, driverSettings);
+                    } catch (const exception& e) {
+                        cout << e.what() << endl;
+                        PrintUsage();
+                        exit(2);
+                    }
+                    break;
+                case 'f':
+                    driverSettings.FastPollInterval = chrono::milliseconds(stoul(optarg));
+                    break;
+                case 'r':
+                    driverSettings.ReadCommands = true;
+                    break;
+                case 'e':
+                    driverSettings.ErrorLogPeriod = chrono::seconds(stoul(optarg));
+                    break;
+                case 'C':
+                    mqttConfig.Id = optarg;
+                    break;
+                case 'D':
+                    deviceId = optarg;
+                    break;
+                case 'b':
+                    try {
+                        shards.push_back(ParseShard(optarg));
+                    } catch (const exception& e) {
+                        cout << e.what() << endl;
+                        PrintUsage();
+                        exit(2);
+                    }
+                    break;
+                case 'E':
+                    eventLoop = true;
+                    break;
+                case 's':
+                    driverSettings.Filter.SensorIds = Split(optarg, ',');
+                    break;
+                case 'k':
+                    driverSettings.ExplicitSearch = true;
+                    break;
+                case 'U':
+                    driverSettings.BatchRead = true;
+                    break;
+                case 'S':
+                    driverSettings.SynchronizedConversion = true;
+                    break;
+                case 'R':
+                    recordFile = optarg;
+                    break;
+                case 'c':
+                    configFile = optarg;
+                    break;
+                case 'T':
+                    driverSettings.SampleTimes = true;
+                    break;
+                case 'M':
+                    try {
+                        ParseShmExport(optarg, shmExportFile, shmExportCapacity);
+                    } catch (const exception& e) {
+                        cout << e.what() << endl;
+                        PrintUsage();
+                        exit(2);
+                    }
+                    break;
+                case 'Y':
+                    try {
+                        driverSettings.SysfsBackend = CreateReplayBackend(optarg);
+                    } catch (const exception& e) {
+                        cout << e.what() << endl;
+                        exit(2);
+                    }
+                    break;
 
                 case '?':
                 default:
@@ -106,6 +435,15 @@ namespace
                 exit(2);
         }
 
+        if (!shmExportFile.empty()) {
+            try {
+                driverSettings.ShmExport = make_shared<TShmExport>(shmExportFile, shmExportCapacity);
+            } catch (const exception& e) {
+                cout << e.what() << endl;
+                exit(2);
+            }
+        }
+
         if (optind < argc) {
             for (int index = optind; index < argc; ++index) {
                 cout << "Skipping unknown argument " << argv[index] << endl;
@@ -119,8 +457,10 @@ int main(int argc, char* argv[])
     WBMQTT::TPromise<void> initialized;
 
     WBMQTT::SetThreadName("main");
-    WBMQTT::SignalHandling::Handle({SIGINT, SIGTERM});
+    TConfigReloader configReloader;
+    WBMQTT::SignalHandling::Handle({SIGINT, SIGTERM, SIGHUP});
     WBMQTT::SignalHandling::OnSignals({SIGINT, SIGTERM}, [&] { WBMQTT::SignalHandling::Stop(); });
+    WBMQTT::SignalHandling::OnSignals({SIGHUP}, [&] { configReloader.Reload(); });
 
     /* if signal arrived before driver is initialized:
         wait some time to initialize and then exit gracefully
@@ -141,9 +481,49 @@ int main(int argc, char* argv[])
     WBMQTT::SignalHandling::Start();
 
     WBMQTT::TMosquittoMqttConfig mqttConfig{};
-    mqttConfig.Id = "wb-w1";
+    mqttConfig.Id = DEFAULT_DEVICE_ID;
     uint32_t pollInterval = DEFAULT_POLL_INTERVALL_MS;
-    ParseCommadLine(argc, argv, mqttConfig, pollInterval);
+    TOneWireDriverSettings driverSettings;
+    string deviceId = DEFAULT_DEVICE_ID;
+    vector<TShardSettings> shards;
+    bool eventLoop = false;
+    string configFile;
+    string recordFile;
+    ParseCommadLine(argc,
+                    argv,
+                    mqttConfig,
+                    pollInterval,
+                    driverSettings,
+                    deviceId,
+                    shards,
+                    eventLoop,
+                    configFile,
+                    recordFile);
+    if (shards.empty()) {
+        shards.emplace_back();
+    }
+    configReloader.Init(configFile, driverSettings, shards);
+    if (!configFile.empty()) {
+        try {
+            LoadDriverConfig(configFile, driverSettings);
+        } catch (const exception& e) {
+            cout << e.what() << endl;
+            exit(2);
+        }
+    }
+
+    // All workers write to the same trace, so they share the recording backend
+    if (!recordFile.empty()) {
+        try {
+            if (driverSettings.BatchRead && !driverSettings.SysfsBackend) {
+                driverSettings.SysfsBackend = CreateBatchReadBackend();
+            }
+            driverSettings.SysfsBackend = make_shared<TRecordingSysfsBackend>(driverSettings.SysfsBackend, recordFile);
+        } catch (const exception& e) {
+            cout << e.what() << endl;
+            exit(2);
+        }
+    }
 
     cout << "MQTT broker " << mqttConfig.Host << ':' << mqttConfig.Port << endl;
 
@@ -160,15 +540,50 @@ int main(int argc, char* argv[])
 
     try {
         {
-            TThreadedPeriodicalRunner r(
-                std::unique_ptr<IPeriodicalWorker>(
-                    new TOneWireDriverWorker("wb-w1", mqttDriver, ::Info, ::Debug, ::Error, "/sys/bus/w1/devices/")),
-                std::chrono::milliseconds(pollInterval),
-                "w1 thread",
-                ::Info);
+            vector<unique_ptr<TThreadedPeriodicalRunner>> runners;
+            vector<TEventLoopRunner::TTask> tasks;
+            vector<TOneWireDriverWorker*> workers;
+            for (size_t i = 0; i < shards.size(); ++i) {
+                auto shardSettings = MakeShardSettings(driverSettings, shards[i]);
+
+                // Every shard gets its own io_uring instance, so shards don't wait for batches of each other
+                if (shardSettings.BatchRead && !shardSettings.SysfsBackend) {
+                    shardSettings.SysfsBackend = CreateBatchReadBackend();
+                }
+                if (i == 0 && !configFile.empty()) {
+                    shardSettings.ReloadConfig = [&configReloader] { configReloader.Reload(); };
+                }
+                auto suffix = (shards.size() == 1) ? string() : "-" + to_string(i + 1);
+                auto shardPollInterval = std::chrono::milliseconds(shards[i].PollInterval ? shards[i].PollInterval
+                                                                                          : pollInterval);
+                auto oneWireWorker = new TOneWireDriverWorker(deviceId + suffix,
+                                                              mqttDriver,
+                                                              ::Info,
+                                                              ::Debug,
+                                                              ::Error,
+                                                              "/sys/bus/w1/devices/",
+                                                              shardSettings);
+                workers.push_back(oneWireWorker);
+                std::unique_ptr<IPeriodicalWorker> worker(oneWireWorker);
+                if (eventLoop) {
+                    tasks.push_back({std::move(worker), shardPollInterval});
+                } else {
+                    runners.push_back(std::make_unique<TThreadedPeriodicalRunner>(std::move(worker),
+                                                                                  shardPollInterval,
+                                                                                  "w1 thread" + suffix,
+                                                                                  ::Info));
+                }
+            }
+            unique_ptr<TEventLoopRunner> eventLoopRunner;
+            if (eventLoop) {
+                eventLoopRunner = std::make_unique<TEventLoopRunner>(std::move(tasks), "w1 event loop", ::Info);
+            }
+
+            configReloader.SetWorkers(workers);
 
             initialized.Complete();
             WBMQTT::SignalHandling::Wait();
+            configReloader.SetWorkers({});
         }
         mqttDriver->StopLoop();
         mqttDriver->Close();
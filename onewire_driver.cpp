@@ -2,6 +2,7 @@
 #include <functional>
 
 #include <algorithm>
+#include <optional>
 
 #define LOG(logger) logger.Log() << "[w1 driver] "
 
@@ -10,58 +11,248 @@ using namespace WBMQTT;
 
 namespace
 {
+    const char* STATISTICS_CONTROL_SUFFIXES[] = {"_min", "_max", "_mean", "_count"};
+    const char* SAMPLE_TIME_CONTROL_SUFFIXES[] = {"_sample_time", "_latency"};
+    const string READ_COMMAND_SUFFIX = "_read";
+    const string RELOAD_CONFIG_CONTROL = "reload_config";
+    const string TRIGGER_SKEW_CONTROL = "trigger_skew";
+
+    // Error kind for exceptions other than TOneWireReadErrorException
+    const int OTHER_READ_ERROR = -1;
+
+    void CreateReadCommand(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx)
+    {
+        device
+            ->CreateControl(tx,
+                            TControlArgs{}.SetId(sensor.GetId() + READ_COMMAND_SUFFIX).SetType("pushbutton"))
+            .GetValue();
+    }
+
+    void DeleteReadCommand(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx)
+    {
+        auto id = sensor.GetId() + READ_COMMAND_SUFFIX;
+        if (device->GetControl(id)) {
+            device->RemoveControl(tx, id).Sync();
+        }
+    }
+
+    template<size_t N>
+    void DeleteSuffixedControls(const TSysfsOneWireThermometer& sensor,
+                                PLocalDevice device,
+                                PDriverTx& tx,
+                                const char* (&suffixes)[N])
+    {
+        for (const auto& suffix: suffixes) {
+            auto id = sensor.GetId() + suffix;
+            if (device->GetControl(id)) {
+                device->RemoveControl(tx, id).Sync();
+            }
+        }
+    }
+
+    void DeleteStatisticsControls(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx)
+    {
+        DeleteSuffixedControls(sensor, device, tx, STATISTICS_CONTROL_SUFFIXES);
+    }
+
+    void DeleteSampleTimeControls(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx)
+    {
+        DeleteSuffixedControls(sensor, device, tx, SAMPLE_TIME_CONTROL_SUFFIXES);
+    }
+
     void DeleteControl(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx, TLogger& infoLogger)
     {
         LOG(infoLogger) << "RemoveControl of: " << sensor.GetId();
         device->RemoveControl(tx, sensor.GetId()).Sync();
+        DeleteStatisticsControls(sensor, device, tx);
+        DeleteSampleTimeControls(sensor, device, tx);
     }
 
-    void UpdateValue(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx, TLogger& errorLogger)
+    void LogReadError(const TSysfsOneWireThermometer& sensor,
+                      const exception& er,
+                      TLogRateLimiter& errorLogLimiter,
+                      TLogger& errorLogger)
     {
-        try {
-            device->GetControl(sensor.GetId())->SetValue(tx, sensor.GetTemperature()).Sync();
-        } catch (const exception& er) {
+        auto readError = dynamic_cast<const TOneWireReadErrorException*>(&er);
+        if (errorLogLimiter.Report(sensor.GetId(), readError ? readError->GetKind() : OTHER_READ_ERROR)) {
             LOG(errorLogger) << er.what();
-            device->GetControl(sensor.GetId())->SetError(tx, "r").Sync();
         }
     }
 
-    void CreateControl(const TSysfsOneWireThermometer& sensor, PLocalDevice device, PDriverTx& tx, TLogger& errorLogger)
+    void UpdateValue(const TSysfsOneWireThermometer& sensor, optional<double> value, PLocalDevice device, PDriverTx& tx)
     {
-        try {
-            device
-                ->CreateControl(tx,
-                                TControlArgs{}
-                                    .SetId(sensor.GetId())
-                                    .SetType("temperature")
-                                    .SetReadonly(true)
-                                    .SetRawValue(FormatFloat(sensor.GetTemperature())))
-                .GetValue();
-        } catch (const exception& er) {
-            LOG(errorLogger) << er.what();
-            device
-                ->CreateControl(
-                    tx,
-                    TControlArgs{}.SetId(sensor.GetId()).SetType("temperature").SetReadonly(true).SetError("r"))
-                .GetValue();
+        auto control = device->GetControl(sensor.GetId());
+        if (value) {
+            control->SetValue(tx, *value).Sync();
+        } else {
+            control->SetError(tx, "r").Sync();
         }
     }
+
+    void CreateControl(const TSysfsOneWireThermometer& sensor,
+                       optional<double> value,
+                       PLocalDevice device,
+                       PDriverTx& tx)
+    {
+        auto args = TControlArgs{}.SetId(sensor.GetId()).SetType("temperature").SetReadonly(true);
+        if (value) {
+            args.SetRawValue(FormatFloat(*value));
+        } else {
+            args.SetError("r");
+        }
+        device->CreateControl(tx, args).GetValue();
+    }
+
+    int64_t ToUnixTimeMs(chrono::steady_clock::time_point time)
+    {
+        auto systemTime = chrono::system_clock::now() - (chrono::steady_clock::now() - time);
+        return chrono::duration_cast<chrono::milliseconds>(systemTime.time_since_epoch()).count();
+    }
+
+    void PublishValue(PLocalDevice device, PDriverTx& tx, const string& id, const string& type, optional<double> value)
+    {
+        auto control = device->GetControl(id);
+        if (!control) {
+            auto args = TControlArgs{}.SetId(id).SetType(type).SetReadonly(true);
+            if (value) {
+                args.SetRawValue(FormatFloat(*value));
+            } else {
+                args.SetError("r");
+            }
+            device->CreateControl(tx, args).GetValue();
+            return;
+        }
+        if (value) {
+            control->SetValue(tx, *value).Sync();
+        } else {
+            control->SetError(tx, "r").Sync();
+        }
+    }
+
+    void PublishRawValue(PLocalDevice device, PDriverTx& tx, const string& id, const string& units, const string& value)
+    {
+        auto control = device->GetControl(id);
+        if (control) {
+            control->SetRawValue(tx, value).Sync();
+            return;
+        }
+        device
+            ->CreateControl(
+                tx,
+                TControlArgs{}.SetId(id).SetType("value").SetUnits(units).SetReadonly(true).SetRawValue(value))
+            .GetValue();
+    }
+
+    void DeleteDeviceControls(const TSysfsOneWireDevice& oneWireDevice,
+                              PLocalDevice device,
+                              PDriverTx& tx,
+                              TLogger& infoLogger)
+    {
+        LOG(infoLogger) << "RemoveControls of: " << oneWireDevice.GetId();
+        for (const auto& channel: oneWireDevice.GetFamily().Channels) {
+            auto id = oneWireDevice.GetId() + "_" + channel.Suffix;
+            if (device->GetControl(id)) {
+                device->RemoveControl(tx, id).Sync();
+            }
+        }
+    }
+
+    void PublishDeviceValues(const TSysfsOneWireDevice& oneWireDevice,
+                             const vector<string>& controlIds,
+                             PLocalDevice device,
+                             PDriverTx& tx,
+                             TLogRateLimiter& errorLogLimiter,
+                             TLogger& errorLogger)
+    {
+        const auto& channels = oneWireDevice.GetFamily().Channels;
+        const auto& values = oneWireDevice.GetValues();
+        bool readError = false;
+        for (size_t i = 0; i < channels.size(); ++i) {
+            PublishValue(device, tx, controlIds[i], channels[i].Type, values[i]);
+            readError = readError || !values[i];
+        }
+        if (readError && errorLogLimiter.Report(oneWireDevice.GetId(), OTHER_READ_ERROR)) {
+            LOG(errorLogger) << "Can't read " << oneWireDevice.GetFamily().Name << " " << oneWireDevice.GetId();
+        }
+    }
+
+    void UpdateStatistics(TSysfsOneWireThermometer& sensor,
+                          const TSensorControlIds& controlIds,
+                          optional<double> value,
+                          PLocalDevice device,
+                          PDriverTx& tx)
+    {
+        auto& statistics = sensor.GetStatistics();
+        if (!statistics.IsEnabled()) {
+            return;
+        }
+        statistics.AddSample(value);
+        if (!statistics.IsReportDue()) {
+            return;
+        }
+        statistics.MarkReported();
+
+        auto hasValues = (statistics.GetCount() != 0);
+        PublishValue(device,
+                     tx,
+                     controlIds.Min,
+                     "temperature",
+                     hasValues ? optional<double>(statistics.GetMin()) : nullopt);
+        PublishValue(device,
+                     tx,
+                     controlIds.Max,
+                     "temperature",
+                     hasValues ? optional<double>(statistics.GetMax()) : nullopt);
+        PublishValue(device,
+                     tx,
+                     controlIds.Mean,
+                     "temperature",
+                     hasValues ? optional<double>(statistics.GetMean()) : nullopt);
+        PublishValue(device, tx, controlIds.Count, "value", statistics.GetCount());
+    }
 } // namespace
 
+TSensorControlIds::TSensorControlIds(const string& sensorId)
+    : Alarm(sensorId + "_alarm"),
+      SampleTime(sensorId + "_sample_time"),
+      Latency(sensorId + "_latency"),
+      Min(sensorId + "_min"),
+      Max(sensorId + "_max"),
+      Mean(sensorId + "_mean"),
+      Count(sensorId + "_count")
+{}
+
 TOneWireDriverWorker::TOneWireDriverWorker(const string& deviceId,
                                            const PDeviceDriver& mqttDriver,
                                            TLogger& infoLogger,
                                            TLogger& debugLogger,
                                            TLogger& errorLogger,
-                                           const string& thermometersSysfsDir)
+                                           const string& thermometersSysfsDir,
+                                           const TOneWireDriverSettings& settings)
     : MqttDriver(mqttDriver),
-      OneWireManager(thermometersSysfsDir, debugLogger, errorLogger),
+      OneWireManager(thermometersSysfsDir, debugLogger, errorLogger, &StopToken, settings.SysfsBackend),
       InfoLogger(infoLogger),
       DebugLogger(debugLogger),
       ErrorLogger(errorLogger),
       DeviceId(deviceId),
-      FirstTime(true)
+      Settings(settings),
+      FirstTime(true),
+      ErrorLogLimiter(settings.ErrorLogPeriod),
+      ReadCommandHandler(nullptr),
+      ReloadConfig(settings.ReloadConfig),
+      ReloadCommandHandler(nullptr),
+      SettingsReloaded(false),
+      AggregationWindowChanged(false),
+      ShmExportFull(false),
+      ConversionPending(false),
+      FullScanPending(false)
 {
+    OneWireManager.SetFilter(Settings.Filter);
+    OneWireManager.SetExplicitSearch(Settings.ExplicitSearch);
+    OneWireManager.SetBatchRead(Settings.BatchRead);
+    OneWireManager.SetPriorities(Settings.Priorities);
+    OneWireManager.SetSynchronizedConversion(Settings.SynchronizedConversion);
+
     auto tx = MqttDriver->BeginTx();
     Device = tx->CreateDevice(TLocalDeviceArgs{}
                                   .SetId(DeviceId)
@@ -70,36 +261,517 @@ TOneWireDriverWorker::TOneWireDriverWorker(const string& deviceId,
                                   .SetIsVirtual(true)
                                   .SetDoLoadPrevious(false))
                  .GetValue();
+
+    UpdateReadCommandHandler();
+
+    if (ReloadConfig) {
+        Device->CreateControl(tx, TControlArgs{}.SetId(RELOAD_CONFIG_CONTROL).SetType("pushbutton")).GetValue();
+        ReloadCommandHandler = MqttDriver->On<TControlOnValueEvent>([this](const TControlOnValueEvent& event) {
+            if (event.Control->GetDevice() == Device && event.Control->GetId() == RELOAD_CONFIG_CONTROL) {
+                ReloadConfig();
+            }
+        });
+    }
+}
+
+void TOneWireDriverWorker::UpdateReadCommandHandler()
+{
+    if (Settings.ReadCommands && !ReadCommandHandler) {
+        ReadCommandHandler = MqttDriver->On<TControlOnValueEvent>([this](const TControlOnValueEvent& event) {
+            if (event.Control->GetDevice() != Device) {
+                return;
+            }
+            const auto& id = event.Control->GetId();
+            if (StringHasSuffix(id, READ_COMMAND_SUFFIX)) {
+                RequestRead(id.substr(0, id.size() - READ_COMMAND_SUFFIX.size()));
+            }
+        });
+    }
+    if (!Settings.ReadCommands && ReadCommandHandler) {
+        MqttDriver->RemoveEventHandler(ReadCommandHandler);
+        ReadCommandHandler = nullptr;
+    }
+}
+
+void TOneWireDriverWorker::UpdateSettings(const TOneWireDriverSettings& settings)
+{
+    function<void()> wakeUp;
+    {
+        lock_guard<mutex> lg(PendingSettingsMutex);
+        PendingSettings = make_unique<TOneWireDriverSettings>(settings);
+    }
+    {
+        lock_guard<mutex> lg(ReadRequestsMutex);
+        wakeUp = WakeUp;
+    }
+    if (wakeUp) {
+        wakeUp();
+    }
+}
+
+void TOneWireDriverWorker::ApplyPendingSettings()
+{
+    unique_ptr<TOneWireDriverSettings> settings;
+    {
+        lock_guard<mutex> lg(PendingSettingsMutex);
+        settings.swap(PendingSettings);
+    }
+    if (!settings) {
+        return;
+    }
+    LOG(InfoLogger) << DeviceId << " settings are reloaded";
+    settings->SysfsBackend = Settings.SysfsBackend;
+    settings->ShmExport = Settings.ShmExport;
+    AggregationWindowChanged = AggregationWindowChanged || (settings->AggregationWindow != Settings.AggregationWindow);
+    if (settings->BatchRead && !Settings.BatchRead) {
+        // SysfsBackend is kept on reload, so io_uring backend can't be created here
+        LOG(InfoLogger) << DeviceId << " batch reading is enabled, io_uring is used only if it was enabled on start";
+    }
+    Settings = *settings;
+
+    OneWireManager.SetFilter(Settings.Filter);
+    OneWireManager.SetExplicitSearch(Settings.ExplicitSearch);
+    OneWireManager.SetBatchRead(Settings.BatchRead);
+    OneWireManager.SetPriorities(Settings.Priorities);
+    OneWireManager.SetSynchronizedConversion(Settings.SynchronizedConversion);
+    ErrorLogLimiter.SetPeriod(Settings.ErrorLogPeriod);
+    UpdateReadCommandHandler();
+    auto tx = MqttDriver->BeginTx();
+    UpdateAlarmThresholds(tx);
+    if (!Settings.SynchronizedConversion && Device->GetControl(TRIGGER_SKEW_CONTROL)) {
+        Device->RemoveControl(tx, TRIGGER_SKEW_CONTROL).Sync();
+    }
+
+    // Filter changes and controls of known thermometers are handled by full scan right away
+    SettingsReloaded = true;
+    NextFullScan = chrono::steady_clock::time_point();
+}
+
+void TOneWireDriverWorker::UpdateAlarmThresholds(PDriverTx& tx)
+{
+    // Alarms of thermometers with new thresholds are created by ReconcileControls
+    for (auto it = Alarms.begin(); it != Alarms.end();) {
+        const auto& id = it->first;
+        auto thresholds = Settings.Thresholds.find(id);
+        if (thresholds == Settings.Thresholds.end()) {
+            AlarmedSensorBuses.erase(id);
+            Device->RemoveControl(tx, id + "_alarm").Sync();
+            it = Alarms.erase(it);
+            continue;
+        }
+        if (!(it->second.GetThresholds() == thresholds->second)) {
+            // The alarm is evaluated again on next reading
+            it->second = TThresholdAlarm(thresholds->second);
+            AlarmedSensorBuses.erase(id);
+            Device->GetControl(id + "_alarm")->SetRawValue(tx, "0").Sync();
+        }
+        ++it;
+    }
+}
+
+void TOneWireDriverWorker::ReconcileControls(TSysfsOneWireThermometer& sensor, optional<double> value, PDriverTx& tx)
+{
+    if (!Alarms.count(sensor.GetId())) {
+        CreateAlarm(sensor, value, tx);
+    }
+    if (AggregationWindowChanged) {
+        sensor.GetStatistics().Reset(Settings.AggregationWindow);
+        DeleteStatisticsControls(sensor, Device, tx);
+    }
+    if (!Settings.SampleTimes) {
+        DeleteSampleTimeControls(sensor, Device, tx);
+    }
+    if (Settings.ReadCommands) {
+        if (!Device->GetControl(sensor.GetId() + READ_COMMAND_SUFFIX)) {
+            CreateReadCommand(sensor, Device, tx);
+        }
+    } else {
+        DeleteReadCommand(sensor, Device, tx);
+    }
 }
 
 void TOneWireDriverWorker::RunIteration()
 {
-    LOG(DebugLogger) << "Rescan bus";
-    auto devices = OneWireManager.RescanBusAndRead();
+    if (!ConversionPending && !StartIteration()) {
+        return;
+    }
+    // The worker doesn't wait for conversion, next call is scheduled to conversion check time
+    if (!OneWireManager.CheckConversions(NextConversionCheck)) {
+        return;
+    }
+    ConversionPending = false;
+    if (FullScanPending) {
+        CompleteFullScan();
+    } else {
+        CompleteBusRead();
+    }
+}
+
+bool TOneWireDriverWorker::StartIteration()
+{
+    ApplyPendingSettings();
+    // Messages of every cycle are formatted only if they are logged, so the cycle doesn't allocate
+    auto debug = DebugLogger.IsEnabled();
+    auto now = chrono::steady_clock::now();
+    if (now < NextFullScan) {
+        BusesToRead = GetBusesToRead();
+        if (BusesToRead.empty()) {
+            return false;
+        }
+        if (debug) {
+            LOG(DebugLogger) << "Read buses";
+        }
+        OneWireManager.StartReadBuses(BusesToRead);
+        FullScanPending = false;
+    } else {
+        LastFullScan = now;
+        if (debug) {
+            LOG(DebugLogger) << "Rescan bus";
+        }
+        OneWireManager.StartRescan();
+        FullScanPending = true;
+    }
+    ConversionPending = true;
+    return true;
+}
+
+void TOneWireDriverWorker::CompleteBusRead()
+{
+    const auto& devices = OneWireManager.CompleteRead();
+    CompleteReadRequests(BusesToRead);
+    auto tx = MqttDriver->BeginTx();
+    PublishTriggerSkew(tx);
+    for (auto sensor: devices) {
+        if (StopToken.IsCancelled()) {
+            return;
+        }
+        auto value = ReadValue(*sensor);
+        UpdateValue(*sensor, value, Device, tx);
+        PublishSampleTime(*sensor, value, tx);
+        UpdateAlarm(*sensor, value, tx);
+    }
+}
+
+void TOneWireDriverWorker::CompleteFullScan()
+{
+    const auto& devices = OneWireManager.CompleteRead();
+    CompleteAllReadRequests();
     auto tx = MqttDriver->BeginTx();
+    PublishTriggerSkew(tx);
 
     for (auto sensor: devices) {
+        if (StopToken.IsCancelled()) {
+            LOG(DebugLogger) << "Iteration is cancelled";
+            return;
+        }
+        optional<double> value;
         switch (sensor->GetStatus()) {
             case TSysfsOneWireThermometer::New:
-                CreateControl(*sensor, Device, tx, ErrorLogger);
+                sensor->GetStatistics().Reset(Settings.AggregationWindow);
+                value = ReadValue(*sensor);
+                CreateControl(*sensor, value, Device, tx);
+                CreateAlarm(*sensor, value, tx);
+                if (Settings.ReadCommands) {
+                    CreateReadCommand(*sensor, Device, tx);
+                }
                 break;
             case TSysfsOneWireThermometer::Connected:
-                UpdateValue(*sensor, Device, tx, ErrorLogger);
+                value = ReadValue(*sensor);
+                UpdateValue(*sensor, value, Device, tx);
+                if (SettingsReloaded) {
+                    ReconcileControls(*sensor, value, tx);
+                }
+                UpdateAlarm(*sensor, value, tx);
                 break;
             case TSysfsOneWireThermometer::Disconnected:
+                ExportDisconnection(*sensor);
                 DeleteControl(*sensor, Device, tx, InfoLogger);
-                break;
+                DeleteAlarm(*sensor, tx);
+                DeleteReadCommand(*sensor, Device, tx);
+                SensorControlIds.erase(sensor->GetId());
+                continue;
         }
+        PublishSampleTime(*sensor, value, tx);
+        UpdateStatistics(*sensor, GetControlIds(*sensor), value, Device, tx);
     }
 
+    for (const auto& oneWireDevice: OneWireManager.GetDevices()) {
+        if (oneWireDevice->GetStatus() == TSysfsOneWireThermometer::Disconnected) {
+            DeleteDeviceControls(*oneWireDevice, Device, tx, InfoLogger);
+            DeviceControlIds.erase(oneWireDevice->GetId());
+        } else {
+            PublishDeviceValues(*oneWireDevice,
+                                GetControlIds(*oneWireDevice),
+                                Device,
+                                tx,
+                                ErrorLogLimiter,
+                                ErrorLogger);
+        }
+    }
+
+    SettingsReloaded = false;
+    AggregationWindowChanged = false;
+
+    // Search between conversions, so it doesn't delay them
+    OneWireManager.TriggerSearch();
+
     if (FirstTime) {
         Device->RemoveUnusedControls(tx).Wait();
         FirstTime = false;
     }
+    FlushErrorLog();
+}
+
+void TOneWireDriverWorker::PublishSampleTime(const TSysfsOneWireThermometer& sensor,
+                                             optional<double> value,
+                                             PDriverTx& tx)
+{
+    auto sampleTime = sensor.GetSampleTime();
+    if (!Settings.SampleTimes || !value || sampleTime == chrono::steady_clock::time_point()) {
+        return;
+    }
+    // The value is already published, so the latency includes MQTT publishing backlog.
+    // Sample time is mapped to wall clock through current time, so it is not affected by clock adjustments
+    // between the sample and the publication
+    auto latency = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - sampleTime);
+    const auto& controlIds = GetControlIds(sensor);
+    PublishRawValue(Device, tx, controlIds.SampleTime, "ms", to_string(ToUnixTimeMs(sampleTime)));
+    PublishRawValue(Device, tx, controlIds.Latency, "ms", to_string(latency.count()));
+}
+
+void TOneWireDriverWorker::PublishTriggerSkew(PDriverTx& tx)
+{
+    if (Settings.SynchronizedConversion) {
+        PublishRawValue(Device, tx, TRIGGER_SKEW_CONTROL, "us", to_string(OneWireManager.GetTriggerSkew().count()));
+    }
+}
+
+optional<double> TOneWireDriverWorker::ReadValue(const TSysfsOneWireThermometer& sensor)
+{
+    optional<double> value;
+    try {
+        value = sensor.GetTemperature();
+    } catch (const exception& er) {
+        LogReadError(sensor, er, ErrorLogLimiter, ErrorLogger);
+    }
+    // Local consumers get the value before it is published to MQTT
+    ExportValue(sensor, value);
+    return value;
+}
+
+void TOneWireDriverWorker::ExportValue(const TSysfsOneWireThermometer& sensor, optional<double> value)
+{
+    if (!Settings.ShmExport) {
+        return;
+    }
+    auto sampleTime = sensor.GetSampleTime();
+    if (!value || sampleTime == chrono::steady_clock::time_point()) {
+        sampleTime = chrono::steady_clock::now();
+    }
+    if (!Settings.ShmExport->Update(sensor.GetId(),
+                                    value ? W1_SHM_OK : W1_SHM_READ_ERROR,
+                                    value.value_or(0),
+                                    ToUnixTimeMs(sampleTime)) &&
+        !ShmExportFull)
+    {
+        LOG(ErrorLogger) << "No free record in shared memory segment for " << sensor.GetId();
+        ShmExportFull = true;
+    }
+}
+
+void TOneWireDriverWorker::ExportDisconnection(const TSysfsOneWireThermometer& sensor)
+{
+    if (Settings.ShmExport) {
+        Settings.ShmExport->Update(sensor.GetId(), W1_SHM_DISCONNECTED, 0, ToUnixTimeMs(chrono::steady_clock::now()));
+    }
+}
+
+void TOneWireDriverWorker::FlushErrorLog()
+{
+    ErrorLogLimiter.Flush([this](const string& sensorId, int kind, size_t count) {
+        auto description = (kind == OTHER_READ_ERROR)
+                               ? "read"
+                               : TOneWireReadErrorException::GetDescription(
+                                     static_cast<TOneWireReadErrorException::TErrorKind>(kind));
+        LOG(ErrorLogger) << sensorId << ": " << count << " '" << description << "' errors in last "
+                         << chrono::duration_cast<chrono::seconds>(ErrorLogLimiter.GetPeriod()).count() << " s";
+    });
+}
+
+chrono::milliseconds TOneWireDriverWorker::GetNextIterationDelay(chrono::milliseconds pollInterval)
+{
+    if (ConversionPending) {
+        // Rounded up, so the check isn't done before its time
+        auto timeToCheck = chrono::ceil<chrono::milliseconds>(NextConversionCheck - chrono::steady_clock::now());
+        return max(chrono::milliseconds(1), timeToCheck);
+    }
+    if (Settings.PollInterval != chrono::milliseconds::zero()) {
+        pollInterval = Settings.PollInterval;
+    }
+    NextFullScan = LastFullScan + pollInterval;
+    auto delay = pollInterval;
+    if (!AlarmedSensorBuses.empty() && Settings.FastPollInterval != chrono::milliseconds::zero()) {
+        delay = Settings.FastPollInterval;
+    }
+    if (HasPendingRequests()) {
+        // Settings or read requests received during conversion
+        return chrono::milliseconds(1);
+    }
+    // Fast polling and read requests don't postpone full scan
+    auto timeToFullScan = chrono::duration_cast<chrono::milliseconds>(NextFullScan - chrono::steady_clock::now());
+    return max(chrono::milliseconds(1), min(delay, timeToFullScan));
+}
+
+bool TOneWireDriverWorker::HasPendingRequests()
+{
+    {
+        lock_guard<mutex> lg(PendingSettingsMutex);
+        if (PendingSettings) {
+            return true;
+        }
+    }
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    return !ReadRequests.empty();
+}
+
+void TOneWireDriverWorker::SetWakeUpHandler(function<void()> wakeUp)
+{
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    WakeUp = wakeUp;
+}
+
+void TOneWireDriverWorker::Cancel()
+{
+    StopToken.Cancel();
+}
+
+void TOneWireDriverWorker::RequestRead(const string& sensorId)
+{
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    ReadRequests.insert(sensorId);
+    if (WakeUp) {
+        WakeUp();
+    }
+}
+
+unordered_set<string> TOneWireDriverWorker::GetBusesToRead()
+{
+    unordered_set<string> buses;
+    for (const auto& sensorBus: AlarmedSensorBuses) {
+        buses.insert(sensorBus.second);
+    }
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    for (auto it = ReadRequests.begin(); it != ReadRequests.end();) {
+        auto sensor = OneWireManager.FindDevice(*it);
+        if (!sensor || sensor->GetStatus() == TSysfsOneWireThermometer::Disconnected) {
+            it = ReadRequests.erase(it);
+        } else {
+            buses.insert(sensor->GetBusDir());
+            ++it;
+        }
+    }
+    return buses;
+}
+
+void TOneWireDriverWorker::CompleteReadRequests(const unordered_set<string>& busDirs)
+{
+    // Requests received during conversion are served by the conversion
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    for (auto it = ReadRequests.begin(); it != ReadRequests.end();) {
+        auto sensor = OneWireManager.FindDevice(*it);
+        if (!sensor || busDirs.count(sensor->GetBusDir())) {
+            it = ReadRequests.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TOneWireDriverWorker::CompleteAllReadRequests()
+{
+    lock_guard<mutex> lg(ReadRequestsMutex);
+    ReadRequests.clear();
+}
+
+void TOneWireDriverWorker::CreateAlarm(const TSysfsOneWireThermometer& sensor, optional<double> value, PDriverTx& tx)
+{
+    auto thresholds = Settings.Thresholds.find(sensor.GetId());
+    if (thresholds == Settings.Thresholds.end()) {
+        return;
+    }
+    Alarms.erase(sensor.GetId());
+    auto& alarm = Alarms.emplace(sensor.GetId(), TThresholdAlarm(thresholds->second)).first->second;
+    if (value) {
+        alarm.Update(*value);
+    }
+    if (alarm.IsActive()) {
+        LOG(InfoLogger) << sensor.GetId() << " value is out of limits";
+        AlarmedSensorBuses[sensor.GetId()] = sensor.GetBusDir();
+    }
+    Device
+        ->CreateControl(tx,
+                        TControlArgs{}
+                            .SetId(sensor.GetId() + "_alarm")
+                            .SetType("alarm")
+                            .SetReadonly(true)
+                            .SetRawValue(alarm.IsActive() ? "1" : "0"))
+        .GetValue();
+}
+
+void TOneWireDriverWorker::UpdateAlarm(const TSysfsOneWireThermometer& sensor, optional<double> value, PDriverTx& tx)
+{
+    auto alarm = Alarms.find(sensor.GetId());
+    if (alarm == Alarms.end() || !value || !alarm->second.Update(*value)) {
+        return;
+    }
+    if (alarm->second.IsActive()) {
+        LOG(InfoLogger) << sensor.GetId() << " value is out of limits";
+        AlarmedSensorBuses[sensor.GetId()] = sensor.GetBusDir();
+    } else {
+        LOG(InfoLogger) << sensor.GetId() << " value is back within limits";
+        AlarmedSensorBuses.erase(sensor.GetId());
+    }
+    Device->GetControl(GetControlIds(sensor).Alarm)->SetRawValue(tx, alarm->second.IsActive() ? "1" : "0").Sync();
+}
+
+const TSensorControlIds& TOneWireDriverWorker::GetControlIds(const TSysfsOneWireThermometer& sensor)
+{
+    auto it = SensorControlIds.find(sensor.GetId());
+    if (it == SensorControlIds.end()) {
+        it = SensorControlIds.emplace(sensor.GetId(), TSensorControlIds(sensor.GetId())).first;
+    }
+    return it->second;
+}
+
+const vector<string>& TOneWireDriverWorker::GetControlIds(const TSysfsOneWireDevice& device)
+{
+    auto it = DeviceControlIds.find(device.GetId());
+    if (it == DeviceControlIds.end()) {
+        vector<string> controlIds;
+        for (const auto& channel: device.GetFamily().Channels) {
+            controlIds.push_back(device.GetId() + "_" + channel.Suffix);
+        }
+        it = DeviceControlIds.emplace(device.GetId(), std::move(controlIds)).first;
+    }
+    return it->second;
+}
+
+void TOneWireDriverWorker::DeleteAlarm(const TSysfsOneWireThermometer& sensor, PDriverTx& tx)
+{
+    AlarmedSensorBuses.erase(sensor.GetId());
+    if (Alarms.erase(sensor.GetId())) {
+        Device->RemoveControl(tx, sensor.GetId() + "_alarm").Sync();
+    }
 }
 
 TOneWireDriverWorker::~TOneWireDriverWorker()
 {
+    if (ReadCommandHandler) {
+        MqttDriver->RemoveEventHandler(ReadCommandHandler);
+    }
+    if (ReloadCommandHandler) {
+        MqttDriver->RemoveEventHandler(ReloadCommandHandler);
+    }
     try {
         MqttDriver->BeginTx()->RemoveDeviceById(DeviceId).Sync();
     } catch (const std::exception& e) {
@@ -1,11 +1,125 @@
 #pragma once
 
+#include "log_limiter.h"
+#include "shm_export.h"
 #include "sysfs_w1.h"
 #include "threaded_runner.h"
+#include "threshold_alarm.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <wblib/log.h>
 #include <wblib/wbmqtt.h>
 
+struct TOneWireDriverSettings
+{
+    /**
+     * @brief Number of polling cycles in rolling window for min/max/mean statistics, 0 - statistics is disabled
+     */
+    size_t AggregationWindow = 0;
+
+    /**
+     * @brief Alarm thresholds of thermometers. Key is thermometer's identifier code
+     */
+    std::unordered_map<std::string, TThresholds> Thresholds;
+
+    /**
+     * @brief Priorities of thermometers, higher priority thermometers are read and published first in a polling cycle.
+     *        Key is thermometer's identifier code, priority of thermometers not listed is 0
+     */
+    std::unordered_map<std::string, int> Priorities;
+
+    /**
+     * @brief Polling interval of buses with thermometers in alarm state, 0 - the buses are polled as usual
+     */
+    std::chrono::milliseconds FastPollInterval = std::chrono::milliseconds::zero();
+
+    /**
+     * @brief Create <id>_read pushbuttons to request immediate reading of a thermometer
+     */
+    bool ReadCommands = false;
+
+    /**
+     * @brief Repeated read errors of the same kind from a thermometer are logged once per the period with a summary,
+     *        0 - log every error
+     */
+    std::chrono::seconds ErrorLogPeriod = std::chrono::seconds(60);
+
+    /**
+     * @brief Sysfs access implementation, e.g. for recording or replaying sysfs traffic, nullptr - plain system calls
+     */
+    PSysfsBackend SysfsBackend;
+
+    /**
+     * @brief Bus masters and thermometers handled by the worker, all by default
+     */
+    TOneWireDeviceFilter Filter;
+
+    /**
+     * @brief Stop kernel background search on bus masters and search once per polling cycle after reading thermometers
+     */
+    bool ExplicitSearch = false;
+
+    /**
+     * @brief Read all thermometers of a polling cycle in one batch, see TSysfsOneWireManager::SetBatchRead.
+     *        The batch is read by SysfsBackend, so io_uring is used only if the caller sets TIoUringSysfsBackend
+     */
+    bool BatchRead = false;
+
+    /**
+     * @brief Trigger conversions on all buses together after devices discovery and publish trigger_skew control,
+     *        see TSysfsOneWireManager::SetSynchronizedConversion
+     */
+    bool SynchronizedConversion = false;
+
+    /**
+     * @brief Publish <id>_sample_time and <id>_latency controls along with thermometer's value.
+     *        <id>_sample_time is conversion completion time of the value, Unix time in ms.
+     *        <id>_latency is time from conversion completion to publication of the value, ms
+     */
+    bool SampleTimes = false;
+
+    /**
+     * @brief Shared memory segment for latest readings of thermometers, nullptr - readings are published to MQTT only.
+     *        The setting can't be changed by TOneWireDriverWorker::UpdateSettings
+     */
+    PShmExport ShmExport;
+
+    /**
+     * @brief Polling interval, 0 - polling interval of the runner is used
+     */
+    std::chrono::milliseconds PollInterval = std::chrono::milliseconds::zero();
+
+    /**
+     * @brief If set, reload_config pushbutton is created. The function is called from MQTT thread on its press.
+     *        The setting can't be changed by TOneWireDriverWorker::UpdateSettings
+     */
+    std::function<void()> ReloadConfig;
+};
+
+/**
+ * @brief Identifiers of auxiliary controls of a thermometer. They are built once for a thermometer,
+ *        so the strings aren't allocated in every polling cycle
+ */
+struct TSensorControlIds
+{
+    explicit TSensorControlIds(const std::string& sensorId);
+
+    std::string Alarm;
+    std::string SampleTime;
+    std::string Latency;
+    std::string Min;
+    std::string Max;
+    std::string Mean;
+    std::string Count;
+};
+
 class TOneWireDriverWorker: public IPeriodicalWorker
 {
 public:
@@ -14,18 +128,124 @@ public:
                          WBMQTT::TLogger& infoLogger,
                          WBMQTT::TLogger& debugLogger,
                          WBMQTT::TLogger& errorLogger,
-                         const std::string& thermometersSysfsDir);
+                         const std::string& thermometersSysfsDir,
+                         const TOneWireDriverSettings& settings = TOneWireDriverSettings());
     ~TOneWireDriverWorker();
 
     void RunIteration() override;
 
+    std::chrono::milliseconds GetNextIterationDelay(std::chrono::milliseconds pollInterval) override;
+
+    void SetWakeUpHandler(std::function<void()> wakeUp) override;
+
+    void Cancel() override;
+
+    /**
+     * @brief Replace settings of the running worker. Can be called from any thread.
+     *        Settings are applied at the beginning of next iteration without recreation of the device,
+     *        known thermometers and their controls are kept. SysfsBackend, ShmExport and ReloadConfig
+     *        are not changed.
+     */
+    void UpdateSettings(const TOneWireDriverSettings& settings);
+
 private:
+    /**
+     * @brief Start conversions of full scan or reading of requested buses
+     *
+     * @return false - there is nothing to read
+     */
+    bool StartIteration();
+    void CompleteFullScan();
+    void CompleteBusRead();
+
+    /**
+     * @brief Check if settings or read requests were received after the start of current iteration
+     */
+    bool HasPendingRequests();
+
+    void RequestRead(const std::string& sensorId);
+    std::unordered_set<std::string> GetBusesToRead();
+    void CompleteReadRequests(const std::unordered_set<std::string>& busDirs);
+    void CompleteAllReadRequests();
+
+    void CreateAlarm(const TSysfsOneWireThermometer& sensor, std::optional<double> value, WBMQTT::PDriverTx& tx);
+    void UpdateAlarm(const TSysfsOneWireThermometer& sensor, std::optional<double> value, WBMQTT::PDriverTx& tx);
+    void DeleteAlarm(const TSysfsOneWireThermometer& sensor, WBMQTT::PDriverTx& tx);
+
+    void FlushErrorLog();
+    void PublishTriggerSkew(WBMQTT::PDriverTx& tx);
+
+    void PublishSampleTime(const TSysfsOneWireThermometer& sensor, std::optional<double> value, WBMQTT::PDriverTx& tx);
+
+    /**
+     * @brief Read thermometer's value, log read error and export the result to shared memory
+     */
+    std::optional<double> ReadValue(const TSysfsOneWireThermometer& sensor);
+    void ExportValue(const TSysfsOneWireThermometer& sensor, std::optional<double> value);
+    void ExportDisconnection(const TSysfsOneWireThermometer& sensor);
+
+    void ApplyPendingSettings();
+    void UpdateAlarmThresholds(WBMQTT::PDriverTx& tx);
+    void UpdateReadCommandHandler();
+
+    /**
+     * @brief Bring alarm, statistics, sample time and read command controls of a known thermometer
+     *        in line with reloaded settings
+     */
+    void ReconcileControls(TSysfsOneWireThermometer& sensor, std::optional<double> value, WBMQTT::PDriverTx& tx);
+
+    const TSensorControlIds& GetControlIds(const TSysfsOneWireThermometer& sensor);
+    const std::vector<std::string>& GetControlIds(const TSysfsOneWireDevice& device);
+
     WBMQTT::PDeviceDriver MqttDriver;
     WBMQTT::PLocalDevice Device;
+    TCancellationToken StopToken;
     TSysfsOneWireManager OneWireManager;
     WBMQTT::TLogger& InfoLogger;
     WBMQTT::TLogger& DebugLogger;
     WBMQTT::TLogger& ErrorLogger;
     std::string DeviceId;
+    TOneWireDriverSettings Settings;
     bool FirstTime;
+    TLogRateLimiter ErrorLogLimiter;
+
+    std::unordered_map<std::string, TThresholdAlarm> Alarms;
+
+    //! Auxiliary controls of known thermometers. Key is thermometer's identifier code
+    std::unordered_map<std::string, TSensorControlIds> SensorControlIds;
+
+    //! Channel controls of known 1-wire devices other than thermometers. Key is device's identifier code
+    std::unordered_map<std::string, std::vector<std::string>> DeviceControlIds;
+
+    //! Bus directories of thermometers in alarm state. Key is thermometer's identifier code
+    std::unordered_map<std::string, std::string> AlarmedSensorBuses;
+
+    std::chrono::steady_clock::time_point LastFullScan;
+    std::chrono::steady_clock::time_point NextFullScan;
+
+    //! Identifier codes of thermometers requested to be read by <id>_read pushbuttons
+    std::unordered_set<std::string> ReadRequests;
+    std::mutex ReadRequestsMutex;
+    std::function<void()> WakeUp;
+    WBMQTT::TDriverEventHandlerHandle ReadCommandHandler;
+
+    std::function<void()> ReloadConfig;
+    WBMQTT::TDriverEventHandlerHandle ReloadCommandHandler;
+
+    //! Settings passed to UpdateSettings and not applied yet
+    std::unique_ptr<TOneWireDriverSettings> PendingSettings;
+    std::mutex PendingSettingsMutex;
+
+    //! Controls of known thermometers must be reconciled with settings during next full scan
+    bool SettingsReloaded;
+    bool AggregationWindowChanged;
+
+    //! Shared memory segment has no free records, the error is logged once
+    bool ShmExportFull;
+
+    //! Conversions of current iteration are started, the iteration is completed when they are finished
+    bool ConversionPending;
+    bool FullScanPending;
+    std::unordered_set<std::string> BusesToRead;
+    std::chrono::steady_clock::time_point NextConversionCheck;
 };
@@ -0,0 +1,214 @@
+#include "onewire_family.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <string_view>
+
+namespace
+{
+    // Identifier code format: 2 hex digits of family code, '-', 12 hex digits of serial number
+    const size_t FAMILY_CODE_LENGTH = 2;
+    const size_t SERIAL_NUMBER_LENGTH = 12;
+    const size_t SERIAL_NUMBER_BITS = SERIAL_NUMBER_LENGTH * 4;
+
+    // Kernel uses lower case, so parsed codes are formatted back exactly
+    bool IsHexDigits(std::string_view str)
+    {
+        return std::all_of(str.begin(), str.end(), [](char c) {
+            return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+        });
+    }
+
+    // DS2438 returns temperature in 1/256 degree units
+    const double DS2438_TEMPERATURE_SCALE = 1.0 / 256;
+
+    // DS2438 returns voltages in 10 mV units
+    const double DS2438_VOLTAGE_SCALE = 0.01;
+
+    // Humidity sensor connected to VAD input of DS2438 (HIH-4000 series), see sensor's datasheet
+    const double HUMIDITY_ZERO_OFFSET = 0.16;
+    const double HUMIDITY_SLOPE = 0.0062;
+    const double HUMIDITY_TEMPERATURE_OFFSET = 1.0546;
+    const double HUMIDITY_TEMPERATURE_SLOPE = 0.00216;
+
+    // DS2423 w1_slave has lines for memory pages 12-15, counters A and B are assigned to pages 14 and 15
+    const size_t DS2423_COUNTER_A_LINE = 2;
+    const size_t DS2423_COUNTERS = 2;
+
+    std::optional<long> ParseInteger(std::string_view str)
+    {
+        auto begin = str.data();
+        auto end = str.data() + str.size();
+        while (begin != end && std::isspace(static_cast<unsigned char>(*begin))) {
+            ++begin;
+        }
+        long value;
+        if (std::from_chars(begin, end, value).ec != std::errc()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    std::optional<double> ParseNumber(const TSysfsReadRequest& attribute, double scale)
+    {
+        if (!attribute.Ok) {
+            return std::nullopt;
+        }
+        auto value = ParseInteger(attribute.Content);
+        if (!value) {
+            return std::nullopt;
+        }
+        return *value * scale;
+    }
+
+    void ParseDs2438(const TSysfsReadRequest* attributes, std::optional<double>* values)
+    {
+        auto& temperature = values[0];
+        auto& vad = values[1];
+        auto& vdd = values[2];
+        auto& humidity = values[3];
+        temperature = ParseNumber(attributes[0], DS2438_TEMPERATURE_SCALE);
+        vad = ParseNumber(attributes[1], DS2438_VOLTAGE_SCALE);
+        vdd = ParseNumber(attributes[2], DS2438_VOLTAGE_SCALE);
+        humidity.reset();
+        if (vad && vdd && *vdd > 0) {
+            auto rh = (*vad / *vdd - HUMIDITY_ZERO_OFFSET) / HUMIDITY_SLOPE;
+            if (temperature) {
+                rh /= HUMIDITY_TEMPERATURE_OFFSET - HUMIDITY_TEMPERATURE_SLOPE * *temperature;
+            }
+            humidity = std::clamp(rh, 0.0, 100.0);
+        }
+    }
+
+    /**
+     * @brief Get bits of PIO state byte
+     *
+     * @param bits bit numbers of channels
+     */
+    void ParseState(const TSysfsReadRequest& state, std::initializer_list<int> bits, std::optional<double>* values)
+    {
+        for (auto bit: bits) {
+            if (state.Ok && !state.Content.empty()) {
+                *values = (static_cast<unsigned char>(state.Content[0]) >> bit) & 1;
+            } else {
+                values->reset();
+            }
+            ++values;
+        }
+    }
+
+    void ParseDs2408(const TSysfsReadRequest* attributes, std::optional<double>* values)
+    {
+        ParseState(attributes[0], {0, 1, 2, 3, 4, 5, 6, 7}, values);
+    }
+
+    void ParseDs2413(const TSysfsReadRequest* attributes, std::optional<double>* values)
+    {
+        // Bit 0 - PIOA pin state, bit 1 - PIOA latch, bit 2 - PIOB pin state, bit 3 - PIOB latch
+        ParseState(attributes[0], {0, 2}, values);
+    }
+
+    void ParseDs2423(const TSysfsReadRequest* attributes, std::optional<double>* values)
+    {
+        for (size_t i = 0; i < DS2423_COUNTERS; ++i) {
+            values[i].reset();
+        }
+        if (!attributes[0].Ok) {
+            return;
+        }
+        // Every line ends with "crc=YES c=<counter>" or "crc=NO c=<counter>"
+        std::string_view content(attributes[0].Content);
+        size_t lineStart = 0;
+        for (size_t line = 0; lineStart < content.size(); ++line) {
+            auto lineEnd = std::min(content.find('\n', lineStart), content.size());
+            auto sLine = content.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+            if (line < DS2423_COUNTER_A_LINE || line >= DS2423_COUNTER_A_LINE + DS2423_COUNTERS ||
+                sLine.find("crc=YES") == std::string_view::npos)
+            {
+                continue;
+            }
+            auto pos = sLine.rfind(" c=");
+            if (pos != std::string_view::npos) {
+                auto value = ParseInteger(sLine.substr(pos + 3));
+                if (value) {
+                    values[line - DS2423_COUNTER_A_LINE] = *value;
+                }
+            }
+        }
+    }
+
+    const std::vector<TOneWireFamily> FAMILIES = {
+        {"10", "DS18S20", true, {}, {}, nullptr},
+        {"22", "DS1822", true, {}, {}, nullptr},
+        {"28", "DS18B20", true, {}, {}, nullptr},
+        {"26",
+         "DS2438",
+         false,
+         {{"temperature", "temperature"}, {"vad", "voltage"}, {"vdd", "voltage"}, {"humidity", "rel_humidity"}},
+         {"temperature", "vad", "vdd"},
+         ParseDs2438},
+        {"29",
+         "DS2408",
+         false,
+         {{"pio0", "switch"},
+          {"pio1", "switch"},
+          {"pio2", "switch"},
+          {"pio3", "switch"},
+          {"pio4", "switch"},
+          {"pio5", "switch"},
+          {"pio6", "switch"},
+          {"pio7", "switch"}},
+         {"state"},
+         ParseDs2408},
+        {"3a", "DS2413", false, {{"pio_a", "switch"}, {"pio_b", "switch"}}, {"state"}, ParseDs2413},
+        {"1d", "DS2423", false, {{"counter_a", "value"}, {"counter_b", "value"}}, {"w1_slave"}, ParseDs2423},
+    };
+}
+
+const TOneWireFamily* FindOneWireFamily(const std::string& deviceId)
+{
+    for (const auto& family: FAMILIES) {
+        if (deviceId.size() > family.Code.size() && deviceId.compare(0, family.Code.size(), family.Code) == 0 &&
+            deviceId[family.Code.size()] == '-')
+        {
+            return &family;
+        }
+    }
+    return nullptr;
+}
+
+const std::vector<TOneWireFamily>& GetOneWireFamilies()
+{
+    return FAMILIES;
+}
+
+std::optional<uint64_t> ParseRomCode(std::string_view deviceId)
+{
+    if (deviceId.size() != FAMILY_CODE_LENGTH + 1 + SERIAL_NUMBER_LENGTH || deviceId[FAMILY_CODE_LENGTH] != '-') {
+        return std::nullopt;
+    }
+    auto family = deviceId.substr(0, FAMILY_CODE_LENGTH);
+    auto serial = deviceId.substr(FAMILY_CODE_LENGTH + 1);
+    if (!IsHexDigits(family) || !IsHexDigits(serial)) {
+        return std::nullopt;
+    }
+    uint64_t familyCode = 0;
+    uint64_t serialNumber = 0;
+    std::from_chars(family.data(), family.data() + family.size(), familyCode, 16);
+    std::from_chars(serial.data(), serial.data() + serial.size(), serialNumber, 16);
+    return (familyCode << SERIAL_NUMBER_BITS) | serialNumber;
+}
+
+std::string FormatRomCode(uint64_t romCode)
+{
+    char buf[FAMILY_CODE_LENGTH + 1 + SERIAL_NUMBER_LENGTH + 1];
+    snprintf(buf,
+             sizeof(buf),
+             "%02llx-%012llx",
+             static_cast<unsigned long long>((romCode >> SERIAL_NUMBER_BITS) & 0xff),
+             static_cast<unsigned long long>(romCode & ((uint64_t(1) << SERIAL_NUMBER_BITS) - 1)));
+    return buf;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "sysfs_backend.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Value of a 1-Wire device published as a separate control
+ *
+ */
+struct TOneWireChannel
+{
+    //! Control id is <device id>_<suffix>
+    std::string Suffix;
+
+    //! Control type, e.g. temperature, voltage, value
+    std::string Type;
+};
+
+/**
+ * @brief Convert content of device's sysfs attributes to channel values
+ *
+ * @param attributes read attributes in order of TOneWireFamily::Attributes
+ * @param values values in order of TOneWireFamily::Channels, std::nullopt - the channel can't be read
+ */
+typedef void (*TOneWireParseFn)(const TSysfsReadRequest* attributes, std::optional<double>* values);
+
+/**
+ * @brief Description of 1-Wire devices family handled by a kernel slave driver
+ *
+ */
+struct TOneWireFamily
+{
+    //! Family code, first part of device identifier code, e.g. 26 for 26-000001b5c1e2
+    std::string Code;
+
+    //! Chip name, e.g. DS2438
+    std::string Name;
+
+    //! Thermometers are handled by TSysfsOneWireThermometer with bulk conversion support
+    bool Thermometer = false;
+
+    std::vector<TOneWireChannel> Channels;
+
+    //! Attributes read every polling cycle, relative to device's sysfs directory
+    std::vector<std::string> Attributes;
+
+    TOneWireParseFn Parse = nullptr;
+};
+
+/**
+ * @brief Find family of a device
+ *
+ * @param deviceId identifier code of a device, e.g. 26-000001b5c1e2
+ * @return family description or nullptr if the family is not supported
+ */
+const TOneWireFamily* FindOneWireFamily(const std::string& deviceId);
+
+/**
+ * @brief Get all supported families
+ */
+const std::vector<TOneWireFamily>& GetOneWireFamilies();
+
+/**
+ * @brief Parse device identifier code into 64-bit key. The key holds family code in bits 48-55
+ *        and serial number in bits 0-47, so keys are ordered as identifier codes.
+ *
+ * @param deviceId identifier code in sysfs format, e.g. 28-00000a013d97
+ * @return key or std::nullopt if the identifier code has wrong format
+ */
+std::optional<uint64_t> ParseRomCode(std::string_view deviceId);
+
+/**
+ * @brief Format key made by ParseRomCode back to identifier code
+ */
+std::string FormatRomCode(uint64_t romCode);
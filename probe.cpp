@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "latency_stats.h"
+#include "sysfs_w1.h"
+#include <wblib/utils.h>
+
+using namespace std;
+using namespace std::chrono;
+
+WBMQTT::TLogger Error("ERROR: ", WBMQTT::TLogger::StdErr, WBMQTT::TLogger::RED);
+WBMQTT::TLogger Debug("DEBUG: ", WBMQTT::TLogger::StdErr, WBMQTT::TLogger::WHITE, false);
+
+const auto DEFAULT_DEVICES_DIR = "/sys/bus/w1/devices/";
+const size_t DEFAULT_ITERATIONS = 100;
+
+namespace
+{
+    enum TProbeMode
+    {
+        BulkMode,  // bulk conversion on buses supporting it
+        DirectMode // every thermometer performs its own conversion
+    };
+
+    struct TProbeSettings
+    {
+        string DevicesDir = DEFAULT_DEVICES_DIR;
+        TOneWireDeviceFilter Filter;
+        size_t Iterations = DEFAULT_ITERATIONS;
+        vector<TProbeMode> Modes = {BulkMode, DirectMode};
+        bool Json = false;
+    };
+
+    struct TSensorStatistics
+    {
+        string Id;
+        TLatencyStatistics ReadTime;
+
+        //! Number of errors by description, see TOneWireReadErrorException::GetDescription
+        map<string, size_t> Errors;
+        size_t ErrorCount = 0;
+    };
+
+    struct TBusStatistics
+    {
+        string Name;
+
+        //! Bulk conversion is used on the bus
+        bool BulkRead = false;
+
+        //! Time of bulk conversion, zero for direct reading
+        TLatencyStatistics ConversionTime;
+
+        //! Time of conversion and reading of all thermometers on the bus
+        TLatencyStatistics CycleTime;
+
+        vector<TSensorStatistics> Sensors;
+    };
+
+    struct TModeStatistics
+    {
+        TProbeMode Mode;
+
+        //! Time of devices discovery with conversion on all buses
+        microseconds DiscoveryTime;
+
+        vector<TBusStatistics> Buses;
+    };
+
+    void PrintUsage()
+    {
+        cout << "Usage:" << endl
+             << "  wb-w1-probe [options]" << endl
+             << "Measures conversion and read latency and error rate of 1-Wire thermometers." << endl
+             << "Stop wb-mqtt-w1 before probing, so it doesn't interfere with measurements." << endl
+             << "Options:" << endl
+             << "  -d dir       directory with bus masters (default: " << DEFAULT_DEVICES_DIR << ")" << endl
+             << "  -b patterns  probe only bus masters matching comma separated wildcard patterns" << endl
+             << "               (e.g. -b 'w1_bus_master[12]')" << endl
+             << "  -s patterns  probe only thermometers matching comma separated wildcard patterns" << endl
+             << "  -n count     number of iterations (default: " << DEFAULT_ITERATIONS << ")" << endl
+             << "  -m mode      bulk - bulk conversion on buses supporting it," << endl
+             << "               direct - conversion per thermometer," << endl
+             << "               both - probe in both modes one after another (default: both)" << endl
+             << "  -j           print results in JSON format" << endl;
+    }
+
+    vector<string> Split(const string& str, char delim)
+    {
+        vector<string> res;
+        stringstream ss(str);
+        string item;
+        while (getline(ss, item, delim)) {
+            if (!item.empty()) {
+                res.push_back(item);
+            }
+        }
+        return res;
+    }
+
+    TProbeSettings ParseCommandLine(int argc, char* argv[])
+    {
+        TProbeSettings settings;
+        int c;
+        while ((c = getopt(argc, argv, "d:b:s:n:m:j")) != -1) {
+            switch (c) {
+                case 'd':
+                    settings.DevicesDir = optarg;
+                    if (settings.DevicesDir.back() != '/') {
+                        settings.DevicesDir += '/';
+                    }
+                    break;
+                case 'b':
+                    settings.Filter.BusMasters = Split(optarg, ',');
+                    break;
+                case 's':
+                    settings.Filter.SensorIds = Split(optarg, ',');
+                    break;
+                case 'n':
+                    settings.Iterations = stoul(optarg);
+                    break;
+                case 'm':
+                    if (string(optarg) == "bulk") {
+                        settings.Modes = {BulkMode};
+                    } else if (string(optarg) == "direct") {
+                        settings.Modes = {DirectMode};
+                    } else if (string(optarg) != "both") {
+                        PrintUsage();
+                        exit(2);
+                    }
+                    break;
+                case 'j':
+                    settings.Json = true;
+                    break;
+                case '?':
+                default:
+                    PrintUsage();
+                    exit(2);
+            }
+        }
+        if (settings.Iterations == 0) {
+            PrintUsage();
+            exit(2);
+        }
+        return settings;
+    }
+
+    string GetBusName(const string& busDir)
+    {
+        return busDir.substr(busDir.rfind('/') + 1);
+    }
+
+    microseconds Elapsed(steady_clock::time_point start)
+    {
+        return duration_cast<microseconds>(steady_clock::now() - start);
+    }
+
+    TModeStatistics Probe(TSysfsOneWireManager& manager, TProbeMode mode, size_t iterations)
+    {
+        TModeStatistics res{mode, microseconds::zero(), {}};
+        manager.SetBulkConversion(mode == BulkMode);
+
+        auto start = steady_clock::now();
+        const auto& devices = manager.RescanBusAndRead();
+        res.DiscoveryTime = Elapsed(start);
+
+        // Buses and thermometers are fixed during probing
+        vector<string> busDirs;
+        for (const auto& sensor: devices) {
+            const auto& busDir = sensor->GetBusDir();
+            auto bus = find(busDirs.begin(), busDirs.end(), busDir);
+            if (bus == busDirs.end()) {
+                busDirs.push_back(busDir);
+                res.Buses.push_back({GetBusName(busDir), false, {}, {}, {}});
+                bus = busDirs.end() - 1;
+            }
+            auto& busStatistics = res.Buses[bus - busDirs.begin()];
+            busStatistics.BulkRead = WBMQTT::StringHasSuffix(sensor->GetDeviceFileName(), "/temperature");
+            busStatistics.Sensors.push_back({sensor->GetId(), {}, {}, 0});
+        }
+
+        for (size_t i = 0; i < iterations; ++i) {
+            for (size_t busIndex = 0; busIndex < busDirs.size(); ++busIndex) {
+                auto& bus = res.Buses[busIndex];
+                auto cycleStart = steady_clock::now();
+                const auto& sensors = manager.ReadBuses({busDirs[busIndex]});
+                bus.ConversionTime.AddSample(Elapsed(cycleStart));
+                for (const auto& sensor: sensors) {
+                    auto sensorStatistics = find_if(bus.Sensors.begin(), bus.Sensors.end(), [&](const auto& s) {
+                        return s.Id == sensor->GetId();
+                    });
+                    if (sensorStatistics == bus.Sensors.end()) {
+                        continue;
+                    }
+                    auto readStart = steady_clock::now();
+                    try {
+                        sensor->GetTemperature();
+                    } catch (const TOneWireReadErrorException& e) {
+                        ++sensorStatistics->Errors[TOneWireReadErrorException::GetDescription(e.GetKind())];
+                        ++sensorStatistics->ErrorCount;
+                    } catch (const exception& e) {
+                        ++sensorStatistics->Errors[e.what()];
+                        ++sensorStatistics->ErrorCount;
+                    }
+                    sensorStatistics->ReadTime.AddSample(Elapsed(readStart));
+                }
+                bus.CycleTime.AddSample(Elapsed(cycleStart));
+            }
+        }
+        return res;
+    }
+
+    const char* GetModeName(TProbeMode mode)
+    {
+        return (mode == BulkMode) ? "bulk" : "direct";
+    }
+
+    double ToMs(microseconds value)
+    {
+        return value.count() / 1000.0;
+    }
+
+    double GetErrorRate(const TSensorStatistics& sensor)
+    {
+        auto reads = sensor.ReadTime.GetCount();
+        return reads ? static_cast<double>(sensor.ErrorCount) / reads : 0;
+    }
+
+    string EscapeJson(const string& str)
+    {
+        string res;
+        for (char c: str) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+            }
+            res += c;
+        }
+        return res;
+    }
+
+    void PrintJson(ostream& out, const TLatencyStatistics& statistics)
+    {
+        out << "{\"p50\": " << ToMs(statistics.GetPercentile(50)) << ", \"p90\": " << ToMs(statistics.GetPercentile(90))
+            << ", \"p99\": " << ToMs(statistics.GetPercentile(99)) << ", \"max\": " << ToMs(statistics.GetMax())
+            << ", \"mean\": " << ToMs(statistics.GetMean()) << "}";
+    }
+
+    void PrintJson(ostream& out, const vector<TModeStatistics>& results, size_t iterations)
+    {
+        out << "{\"iterations\": " << iterations << ", \"modes\": [";
+        for (size_t m = 0; m < results.size(); ++m) {
+            const auto& mode = results[m];
+            out << (m ? ", " : "") << "{\"mode\": \"" << GetModeName(mode.Mode)
+                << "\", \"discovery_ms\": " << ToMs(mode.DiscoveryTime) << ", \"buses\": [";
+            for (size_t b = 0; b < mode.Buses.size(); ++b) {
+                const auto& bus = mode.Buses[b];
+                out << (b ? ", " : "") << "{\"bus\": \"" << EscapeJson(bus.Name)
+                    << "\", \"bulk_read\": " << (bus.BulkRead ? "true" : "false") << ", \"conversion_ms\": ";
+                PrintJson(out, bus.ConversionTime);
+                out << ", \"cycle_ms\": ";
+                PrintJson(out, bus.CycleTime);
+                out << ", \"sensors\": [";
+                for (size_t s = 0; s < bus.Sensors.size(); ++s) {
+                    const auto& sensor = bus.Sensors[s];
+                    out << (s ? ", " : "") << "{\"id\": \"" << EscapeJson(sensor.Id)
+                        << "\", \"reads\": " << sensor.ReadTime.GetCount() << ", \"errors\": " << sensor.ErrorCount
+                        << ", \"error_rate\": " << GetErrorRate(sensor) << ", \"error_kinds\": {";
+                    bool first = true;
+                    for (const auto& error: sensor.Errors) {
+                        out << (first ? "" : ", ") << "\"" << EscapeJson(error.first) << "\": " << error.second;
+                        first = false;
+                    }
+                    out << "}, \"read_ms\": ";
+                    PrintJson(out, sensor.ReadTime);
+                    out << "}";
+                }
+                out << "]}";
+            }
+            out << "]}";
+        }
+        out << "]}" << endl;
+    }
+
+    void PrintRow(ostream& out, const string& name, const TLatencyStatistics& statistics)
+    {
+        out << "  " << left << setw(24) << name << right << setw(10) << ToMs(statistics.GetPercentile(50))
+            << setw(10) << ToMs(statistics.GetPercentile(90)) << setw(10) << ToMs(statistics.GetPercentile(99))
+            << setw(10) << ToMs(statistics.GetMax());
+    }
+
+    void PrintText(ostream& out, const vector<TModeStatistics>& results, size_t iterations)
+    {
+        out << fixed << setprecision(2);
+        for (const auto& mode: results) {
+            out << "Mode: " << GetModeName(mode.Mode) << ", iterations: " << iterations
+                << ", discovery: " << ToMs(mode.DiscoveryTime) << " ms" << endl;
+            if (mode.Buses.empty()) {
+                out << "  no thermometers found" << endl;
+            }
+            for (const auto& bus: mode.Buses) {
+                out << bus.Name << " (" << (bus.BulkRead ? "bulk conversion" : "direct reading")
+                    << "), latency, ms:" << endl;
+                out << "  " << left << setw(24) << "" << right << setw(10) << "p50" << setw(10) << "p90" << setw(10)
+                    << "p99" << setw(10) << "max" << setw(10) << "errors" << endl;
+                PrintRow(out, "conversion", bus.ConversionTime);
+                out << endl;
+                PrintRow(out, "cycle", bus.CycleTime);
+                out << endl;
+                for (const auto& sensor: bus.Sensors) {
+                    PrintRow(out, sensor.Id, sensor.ReadTime);
+                    out << setw(9) << GetErrorRate(sensor) * 100 << "%";
+                    for (const auto& error: sensor.Errors) {
+                        out << "  " << error.first << ": " << error.second;
+                    }
+                    out << endl;
+                }
+            }
+            out << endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto settings = ParseCommandLine(argc, argv);
+    try {
+        TSysfsOneWireManager manager(settings.DevicesDir, Debug, Error);
+        manager.SetFilter(settings.Filter);
+        vector<TModeStatistics> results;
+        for (auto mode: settings.Modes) {
+            results.push_back(Probe(manager, mode, settings.Iterations));
+        }
+        if (settings.Json) {
+            PrintJson(cout, results, settings.Iterations);
+        } else {
+            PrintText(cout, results, settings.Iterations);
+        }
+    } catch (const exception& e) {
+        Error.Log() << e.what();
+        return 1;
+    }
+    return 0;
+}
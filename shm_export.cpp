@@ -0,0 +1,176 @@
+#include "shm_export.h"
+
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    [[noreturn]] void ThrowSystemError(const string& what)
+    {
+        throw system_error(errno, generic_category(), what);
+    }
+
+    void Store(atomic<uint32_t>* words, const void* value)
+    {
+        uint32_t data[2];
+        memcpy(data, value, sizeof(data));
+        words[0].store(data[0], memory_order_relaxed);
+        words[1].store(data[1], memory_order_relaxed);
+    }
+
+    int64_t LoadTimestamp(const TW1ShmRecord& record)
+    {
+        uint32_t data[2] = {record.Timestamp[0].load(memory_order_relaxed),
+                            record.Timestamp[1].load(memory_order_relaxed)};
+        int64_t timestamp;
+        memcpy(&timestamp, data, sizeof(timestamp));
+        return timestamp;
+    }
+
+    void StoreId(TW1ShmRecord& record, const string& id)
+    {
+        uint32_t data[W1_SHM_ID_SIZE / sizeof(uint32_t)] = {};
+        memcpy(data, id.data(), id.size());
+        for (size_t i = 0; i < W1_SHM_ID_SIZE / sizeof(uint32_t); ++i) {
+            record.Id[i].store(data[i], memory_order_relaxed);
+        }
+    }
+}
+
+TShmExport::TShmExport(const string& path, size_t capacity)
+    : Path(path),
+      Size(sizeof(TW1ShmHeader) + capacity * sizeof(TW1ShmRecord))
+{
+    if (capacity == 0 || capacity > GetMaxCapacity()) {
+        throw invalid_argument("invalid shared memory capacity: " + to_string(capacity));
+    }
+    auto tmpPath = Path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ThrowSystemError("can't create " + tmpPath);
+    }
+    if (ftruncate(fd, Size) != 0) {
+        auto error = errno;
+        close(fd);
+        unlink(tmpPath.c_str());
+        throw system_error(error, generic_category(), "can't resize " + tmpPath);
+    }
+    Data = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto error = errno;
+    close(fd);
+    if (Data == MAP_FAILED) {
+        unlink(tmpPath.c_str());
+        throw system_error(error, generic_category(), "can't map " + tmpPath);
+    }
+
+    // The file is zero filled, so all records are empty
+    Header = new (Data) TW1ShmHeader{};
+    Header->Magic = W1_SHM_MAGIC;
+    Header->Version = W1_SHM_VERSION;
+    Header->RecordSize = sizeof(TW1ShmRecord);
+    Header->Capacity = capacity;
+    Records = reinterpret_cast<TW1ShmRecord*>(static_cast<char*>(Data) + sizeof(TW1ShmHeader));
+    for (size_t i = 0; i < capacity; ++i) {
+        new (Records + i) TW1ShmRecord{};
+    }
+
+    if (rename(tmpPath.c_str(), Path.c_str()) != 0) {
+        error = errno;
+        munmap(Data, Size);
+        unlink(tmpPath.c_str());
+        throw system_error(error, generic_category(), "can't rename " + tmpPath);
+    }
+}
+
+size_t TShmExport::GetMaxCapacity()
+{
+    auto maxMappedRecords = (numeric_limits<size_t>::max() - sizeof(TW1ShmHeader)) / sizeof(TW1ShmRecord);
+    return min<size_t>(numeric_limits<decltype(TW1ShmHeader::Capacity)>::max(), maxMappedRecords);
+}
+
+TShmExport::~TShmExport()
+{
+    munmap(Data, Size);
+    unlink(Path.c_str());
+}
+
+unordered_map<string, size_t>::iterator TShmExport::FindOldestDisconnected()
+{
+    auto oldest = Indexes.end();
+    int64_t oldestTimestamp = 0;
+    for (auto it = Indexes.begin(); it != Indexes.end(); ++it) {
+        const auto& record = Records[it->second];
+        if (record.Status.load(memory_order_relaxed) != W1_SHM_DISCONNECTED) {
+            continue;
+        }
+        auto timestamp = LoadTimestamp(record);
+        if (oldest == Indexes.end() || timestamp < oldestTimestamp) {
+            oldest = it;
+            oldestTimestamp = timestamp;
+        }
+    }
+    return oldest;
+}
+
+TW1ShmRecord* TShmExport::FindRecord(const string& id, bool& isNew)
+{
+    isNew = false;
+    auto it = Indexes.find(id);
+    if (it != Indexes.end()) {
+        return Records + it->second;
+    }
+    if (id.size() >= W1_SHM_ID_SIZE) {
+        return nullptr;
+    }
+    size_t index = Header->Count.load(memory_order_relaxed);
+    if (index == Header->Capacity) {
+        auto oldest = FindOldestDisconnected();
+        if (oldest == Indexes.end()) {
+            return nullptr;
+        }
+        index = oldest->second;
+        Indexes.erase(oldest);
+    }
+    Indexes.emplace(id, index);
+    isNew = true;
+    return Records + index;
+}
+
+bool TShmExport::Update(const string& id, TW1ShmStatus status, double temperature, int64_t timestamp)
+{
+    lock_guard<mutex> lg(Mutex);
+    if (status == W1_SHM_DISCONNECTED && !Indexes.count(id)) {
+        // The record is already reused or never existed, don't take a record from another thermometer
+        return false;
+    }
+    bool isNew;
+    auto record = FindRecord(id, isNew);
+    if (!record) {
+        return false;
+    }
+    auto sequence = record->Sequence.load(memory_order_relaxed);
+    record->Sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    record->Status.store(status, memory_order_relaxed);
+    if (isNew) {
+        // A reused record must not show the value of the previous thermometer
+        StoreId(*record, id);
+        double noValue = 0;
+        Store(record->Temperature, &noValue);
+    }
+    if (status == W1_SHM_OK) {
+        Store(record->Temperature, &temperature);
+    }
+    Store(record->Timestamp, &timestamp);
+    record->Sequence.store(sequence + 2, memory_order_release);
+
+    // A new record is visible to readers after it is counted
+    auto index = static_cast<uint32_t>(record - Records);
+    if (index == Header->Count.load(memory_order_relaxed)) {
+        Header->Count.store(index + 1, memory_order_release);
+    }
+    return true;
+}
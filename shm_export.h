@@ -0,0 +1,75 @@
+#pragma once
+
+#include "w1_shm.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Writer of latest thermometers' readings to shared memory segment, the layout is described in w1_shm.h.
+ *        Readers use TW1ShmReader. The object can be shared by several workers, a record must be updated
+ *        by one worker at a time.
+ *
+ */
+class TShmExport
+{
+public:
+    /**
+     * @brief Create the segment. It is initialized under temporary name and then renamed,
+     *        so readers never see partially initialized segment. Throws std::system_error on failure
+     *        and std::invalid_argument if capacity is 0 or greater than GetMaxCapacity().
+     *
+     * @param path segment file, e.g. /dev/shm/wb-mqtt-w1, existing file is replaced
+     * @param capacity maximum number of thermometers
+     */
+    TShmExport(const std::string& path, size_t capacity);
+
+    //! Maximum capacity fitting into the header's field and the size of the mapping
+    static size_t GetMaxCapacity();
+
+    /**
+     * @brief Unmap and remove the segment. Readers with mapped segment keep last values
+     */
+    ~TShmExport();
+
+    TShmExport(const TShmExport&) = delete;
+    TShmExport& operator=(const TShmExport&) = delete;
+
+    /**
+     * @brief Update a record of a thermometer, the record is created on first call. If all records are used,
+     *        the record of the thermometer disconnected for the longest time is reused.
+     *
+     * @param id thermometer's identifier code
+     * @param status new status, temperature is kept unchanged if it is not W1_SHM_OK
+     * @param temperature read value, Celsius degrees
+     * @param timestamp Unix time in ms
+     * @return false - there is neither free nor disconnected record for new thermometer,
+     *         the identifier code is too long or a thermometer without record is disconnected
+     */
+    bool Update(const std::string& id, TW1ShmStatus status, double temperature, int64_t timestamp);
+
+private:
+    /**
+     * @brief Find record of a thermometer or allocate a new one
+     *
+     * @param isNew set to true if the record is allocated and its identifier code must be written
+     */
+    TW1ShmRecord* FindRecord(const std::string& id, bool& isNew);
+
+    //! Entry of Indexes with the record of the thermometer disconnected for the longest time or Indexes.end()
+    std::unordered_map<std::string, size_t>::iterator FindOldestDisconnected();
+
+    std::string Path;
+    void* Data;
+    size_t Size;
+    TW1ShmHeader* Header;
+    TW1ShmRecord* Records;
+
+    //! Record indexes, key is thermometer's identifier code
+    std::unordered_map<std::string, size_t> Indexes;
+    std::mutex Mutex;
+};
+
+typedef std::shared_ptr<TShmExport> PShmExport;
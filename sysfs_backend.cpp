@@ -0,0 +1,86 @@
+#include "sysfs_backend.h"
+
+#include "file_utils.h"
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+ISysfsBackend::~ISysfsBackend()
+{}
+
+void AssignEntry(std::vector<std::string>& entries, size_t index, std::string_view value)
+{
+    if (index < entries.size()) {
+        entries[index].assign(value);
+    } else {
+        entries.emplace_back(value);
+    }
+}
+
+void ISysfsBackend::ReadFiles(std::vector<TSysfsReadRequest>& requests)
+{
+    for (auto& request: requests) {
+        request.Ok = ReadFile(request.Path, request.Content);
+    }
+}
+
+void TPlainSysfsBackend::ListDir(const std::string& dir, std::vector<std::string>& entries)
+{
+    // getdents64 is used instead of opendir and std::filesystem, so listing doesn't allocate memory
+    auto fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw TNoDirError("Can't open directory: " + dir);
+    }
+    alignas(dirent64) char buf[4096];
+    size_t count = 0;
+    ssize_t s;
+    while ((s = getdents64(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t pos = 0; pos < s;) {
+            auto entry = reinterpret_cast<const dirent64*>(buf + pos);
+            pos += entry->d_reclen;
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                AssignEntry(entries, count++, entry->d_name);
+            }
+        }
+    }
+    close(fd);
+    entries.resize(count);
+}
+
+bool TPlainSysfsBackend::Exists(const std::string& path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+bool TPlainSysfsBackend::ReadFile(const std::string& path, std::string& content)
+{
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    // sysfs entries are short, so the buffer is reserved once and reused by following reads
+    const size_t minCapacity = 256;
+    content.clear();
+    if (content.capacity() < minCapacity) {
+        content.reserve(minCapacity);
+    }
+    char buf[256];
+    ssize_t s;
+    while ((s = read(fd, buf, sizeof(buf))) > 0) {
+        content.append(buf, s);
+    }
+    close(fd);
+    return true;
+}
+
+bool TPlainSysfsBackend::WriteFile(const std::string& path, const std::string& data)
+{
+    auto fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    auto s = write(fd, data.data(), data.size());
+    close(fd);
+    return s == static_cast<ssize_t>(data.size());
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief File to read in ISysfsBackend::ReadFiles batch
+ *
+ */
+struct TSysfsReadRequest
+{
+    std::string Path;
+
+    //! File content, see ISysfsBackend::ReadFile
+    std::string Content;
+
+    //! false - the file can't be opened
+    bool Ok = false;
+};
+
+/**
+ * @brief Interface of sysfs access used by TSysfsOneWireManager and TSysfsOneWireThermometer.
+ *        It allows to record and replay sysfs traffic.
+ *
+ */
+class ISysfsBackend
+{
+public:
+    virtual ~ISysfsBackend();
+
+    /**
+     * @brief Get names of directory entries. Throws TNoDirError if the directory can't be opened.
+     *
+     * @param dir directory to list
+     * @param entries vector to store entry names, previous entries are replaced
+     */
+    virtual void ListDir(const std::string& dir, std::vector<std::string>& entries) = 0;
+
+    /**
+     * @brief Check if a file exists
+     */
+    virtual bool Exists(const std::string& path) = 0;
+
+    /**
+     * @brief Read whole file content. Content read before an error is returned if reading fails.
+     *
+     * @param path file to read
+     * @param content string to store file content
+     * @return true - the file is read
+     * @return false - the file can't be opened
+     */
+    virtual bool ReadFile(const std::string& path, std::string& content) = 0;
+
+    /**
+     * @brief Write data to a file opened in append mode
+     *
+     * @return true - all data is written
+     * @return false - the file can't be opened or written
+     */
+    virtual bool WriteFile(const std::string& path, const std::string& data) = 0;
+
+    /**
+     * @brief Read several files. The default implementation calls ReadFile for every file,
+     *        backends can read them in one batch.
+     */
+    virtual void ReadFiles(std::vector<TSysfsReadRequest>& requests);
+};
+
+typedef std::shared_ptr<ISysfsBackend> PSysfsBackend;
+
+/**
+ * @brief Set entries[index] to value. Memory of existing strings is reused, so repeated listings don't allocate.
+ *        The vector is extended if index is equal to its size.
+ */
+void AssignEntry(std::vector<std::string>& entries, size_t index, std::string_view value);
+
+/**
+ * @brief Sysfs access with plain system calls
+ *
+ */
+class TPlainSysfsBackend: public ISysfsBackend
+{
+public:
+    void ListDir(const std::string& dir, std::vector<std::string>& entries) override;
+    bool Exists(const std::string& path) override;
+    bool ReadFile(const std::string& path, std::string& content) override;
+    bool WriteFile(const std::string& path, const std::string& data) override;
+};
@@ -0,0 +1,309 @@
+#include "sysfs_io_uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+    // sysfs attributes are not longer than a page, so a single read is enough
+    const size_t READ_BUFFER_SIZE = 4096;
+
+    std::system_error MakeSystemError(int error, const std::string& message)
+    {
+        return std::system_error(error, std::generic_category(), message);
+    }
+
+    template<class T> T* Offset(void* base, size_t offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    unsigned LoadAcquire(const unsigned* p)
+    {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    void StoreRelease(unsigned* p, unsigned value)
+    {
+        __atomic_store_n(p, value, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Closes opened descriptors if reading of a chunk fails before their closing is submitted
+     */
+    class TOpenedFdsGuard
+    {
+    public:
+        TOpenedFdsGuard(std::vector<int>& fds, size_t count): Fds(fds), Count(count), Released(false)
+        {}
+
+        ~TOpenedFdsGuard()
+        {
+            if (Released) {
+                return;
+            }
+            for (size_t i = 0; i < Count; ++i) {
+                if (Fds[i] >= 0) {
+                    close(Fds[i]);
+                }
+            }
+        }
+
+        TOpenedFdsGuard(const TOpenedFdsGuard&) = delete;
+        TOpenedFdsGuard& operator=(const TOpenedFdsGuard&) = delete;
+
+        //! The descriptors are closed by somebody else
+        void Release()
+        {
+            Released = true;
+        }
+
+    private:
+        std::vector<int>& Fds;
+        size_t Count;
+        bool Released;
+    };
+}
+
+/**
+ * @brief Minimal io_uring wrapper over raw system calls
+ *
+ */
+class TIoUringSysfsBackend::TRing
+{
+public:
+    explicit TRing(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        Fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (Fd < 0) {
+            throw MakeSystemError(errno, "io_uring_setup failed");
+        }
+        try {
+            Map(params);
+            CheckOperations({IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE});
+        } catch (...) {
+            Unmap();
+            close(Fd);
+            throw;
+        }
+    }
+
+    ~TRing()
+    {
+        Unmap();
+        close(Fd);
+    }
+
+    unsigned GetCapacity() const
+    {
+        return SqEntries;
+    }
+
+    /**
+     * @brief Get next free submission queue entry, it is submitted by Submit call
+     */
+    io_uring_sqe* GetSqe()
+    {
+        auto index = SqLocalTail & *SqMask;
+        auto sqe = &Sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        SqArray[index] = index;
+        ++SqLocalTail;
+        return sqe;
+    }
+
+    /**
+     * @brief Submit prepared entries and wait for all their completions
+     *
+     * @param results results of operations indexed by user_data of submission queue entries
+     */
+    void Submit(std::vector<int>& results)
+    {
+        auto toSubmit = SqLocalTail - *SqTail;
+        StoreRelease(SqTail, SqLocalTail);
+        auto toComplete = toSubmit;
+        while (toComplete != 0) {
+            auto res = syscall(__NR_io_uring_enter, Fd, toSubmit, toComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (res < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw MakeSystemError(errno, "io_uring_enter failed");
+            }
+            toSubmit -= res;
+            auto head = *CqHead;
+            auto tail = LoadAcquire(CqTail);
+            for (; head != tail; ++head) {
+                const auto& cqe = Cqes[head & *CqMask];
+                results[cqe.user_data] = cqe.res;
+                --toComplete;
+            }
+            StoreRelease(CqHead, head);
+        }
+    }
+
+private:
+    void Map(const io_uring_params& params)
+    {
+        SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize);
+        }
+        SqRing = MapRegion(SqRingSize, IORING_OFF_SQ_RING);
+        CqRing = singleMap ? SqRing : MapRegion(CqRingSize, IORING_OFF_CQ_RING);
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        Sqes = static_cast<io_uring_sqe*>(MapRegion(SqesSize, IORING_OFF_SQES));
+
+        SqEntries = params.sq_entries;
+        SqTail = Offset<unsigned>(SqRing, params.sq_off.tail);
+        SqMask = Offset<unsigned>(SqRing, params.sq_off.ring_mask);
+        SqArray = Offset<unsigned>(SqRing, params.sq_off.array);
+        SqLocalTail = *SqTail;
+        CqHead = Offset<unsigned>(CqRing, params.cq_off.head);
+        CqTail = Offset<unsigned>(CqRing, params.cq_off.tail);
+        CqMask = Offset<unsigned>(CqRing, params.cq_off.ring_mask);
+        Cqes = Offset<io_uring_cqe>(CqRing, params.cq_off.cqes);
+    }
+
+    void* MapRegion(size_t size, off_t offset)
+    {
+        auto res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, offset);
+        if (res == MAP_FAILED) {
+            throw MakeSystemError(errno, "io_uring mmap failed");
+        }
+        return res;
+    }
+
+    void Unmap()
+    {
+        if (Sqes) {
+            munmap(Sqes, SqesSize);
+        }
+        if (CqRing && CqRing != SqRing) {
+            munmap(CqRing, CqRingSize);
+        }
+        if (SqRing) {
+            munmap(SqRing, SqRingSize);
+        }
+    }
+
+    void CheckOperations(std::initializer_list<int> operations)
+    {
+        const size_t maxOperations = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + maxOperations * sizeof(io_uring_probe_op));
+        auto probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(__NR_io_uring_register, Fd, IORING_REGISTER_PROBE, probe, maxOperations) < 0) {
+            throw MakeSystemError(errno, "io_uring probe failed");
+        }
+        for (auto op: operations) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                throw MakeSystemError(EOPNOTSUPP, "io_uring operation " + std::to_string(op) + " is not supported");
+            }
+        }
+    }
+
+    int Fd = -1;
+    void* SqRing = nullptr;
+    void* CqRing = nullptr;
+    size_t SqRingSize = 0;
+    size_t CqRingSize = 0;
+    io_uring_sqe* Sqes = nullptr;
+    size_t SqesSize = 0;
+
+    unsigned SqEntries = 0;
+    unsigned* SqTail = nullptr;
+    unsigned* SqMask = nullptr;
+    unsigned* SqArray = nullptr;
+    unsigned SqLocalTail = 0;
+    unsigned* CqHead = nullptr;
+    unsigned* CqTail = nullptr;
+    unsigned* CqMask = nullptr;
+    io_uring_cqe* Cqes = nullptr;
+};
+
+TIoUringSysfsBackend::TIoUringSysfsBackend(unsigned queueDepth): Ring(std::make_unique<TRing>(queueDepth))
+{}
+
+TIoUringSysfsBackend::~TIoUringSysfsBackend()
+{}
+
+void TIoUringSysfsBackend::ReadFiles(std::vector<TSysfsReadRequest>& requests)
+{
+    std::lock_guard<std::mutex> lg(Mutex);
+    for (size_t i = 0; i < requests.size(); i += Ring->GetCapacity()) {
+        ReadChunk(&requests[i], std::min<size_t>(Ring->GetCapacity(), requests.size() - i));
+    }
+}
+
+void TIoUringSysfsBackend::ReadChunk(TSysfsReadRequest* requests, size_t count)
+{
+    Results.resize(count);
+    Fds.assign(count, -1);
+
+    // Completions are stored right to Fds, so descriptors opened before a failure are closed too
+    TOpenedFdsGuard guard(Fds, count);
+    for (size_t i = 0; i < count; ++i) {
+        auto sqe = Ring->GetSqe();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(requests[i].Path.c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+    }
+    Ring->Submit(Fds);
+
+    size_t opened = 0;
+    for (size_t i = 0; i < count; ++i) {
+        requests[i].Ok = (Fds[i] >= 0);
+        requests[i].Content.clear();
+        if (requests[i].Ok) {
+            requests[i].Content.resize(READ_BUFFER_SIZE);
+            auto sqe = Ring->GetSqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = Fds[i];
+            sqe->addr = reinterpret_cast<uintptr_t>(requests[i].Content.data());
+            sqe->len = READ_BUFFER_SIZE;
+            sqe->off = 0;
+            sqe->user_data = i;
+            ++opened;
+        }
+    }
+    if (opened == 0) {
+        return;
+    }
+    Ring->Submit(Results);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!requests[i].Ok) {
+            continue;
+        }
+        auto& content = requests[i].Content;
+        content.resize(std::max(Results[i], 0));
+        if (content.size() == READ_BUFFER_SIZE) {
+            // Unexpectedly long file, read the rest with plain system calls
+            char buf[256];
+            ssize_t s;
+            while ((s = pread(Fds[i], buf, sizeof(buf), content.size())) > 0) {
+                content.append(buf, s);
+            }
+        }
+        auto sqe = Ring->GetSqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = Fds[i];
+        sqe->user_data = i;
+    }
+    // Submitted descriptors can be closed by the ring before a failure, so they must not be closed again
+    guard.Release();
+    Ring->Submit(Results);
+}
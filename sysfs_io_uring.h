@@ -0,0 +1,45 @@
+#pragma once
+
+#include "sysfs_backend.h"
+
+#include <mutex>
+
+/**
+ * @brief Sysfs access which performs batch reads with io_uring.
+ *        All files of a batch are opened, read and closed with three io_uring_enter calls
+ *        instead of separate system calls for every file. Reads of different buses run in parallel.
+ *        Batches submitted from different threads are serialized, so a worker thread should have its own instance.
+ *        Other requests are performed with plain system calls.
+ *
+ */
+class TIoUringSysfsBackend: public TPlainSysfsBackend
+{
+public:
+    /**
+     * @brief Construct a new TIoUringSysfsBackend object.
+     *        Throws std::system_error if io_uring or required operations are not supported by the kernel.
+     *
+     * @param queueDepth maximum number of files in a single submission, bigger batches are split
+     */
+    explicit TIoUringSysfsBackend(unsigned queueDepth = 64);
+    ~TIoUringSysfsBackend();
+
+    TIoUringSysfsBackend(const TIoUringSysfsBackend&) = delete;
+    TIoUringSysfsBackend& operator=(const TIoUringSysfsBackend&) = delete;
+
+    void ReadFiles(std::vector<TSysfsReadRequest>& requests) override;
+
+private:
+    class TRing;
+
+    void ReadChunk(TSysfsReadRequest* requests, size_t count);
+
+    std::unique_ptr<TRing> Ring;
+
+    // Buffers reused between batches
+    std::vector<int> Fds;
+    std::vector<int> Results;
+
+    //! The ring and the buffers are used by one batch at a time
+    std::mutex Mutex;
+};
@@ -0,0 +1,286 @@
+#include "sysfs_trace.h"
+
+#include "file_utils.h"
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace
+{
+    const auto TRACE_HEADER = "# wb-mqtt-w1 sysfs trace v1";
+    const char LIST_DIR_OP = 'L';
+    const char EXISTS_OP = 'E';
+    const char READ_FILE_OP = 'R';
+    const char WRITE_FILE_OP = 'W';
+
+    // Directory entries can't contain '/', so it is used as a separator
+    const char ENTRIES_SEPARATOR = '/';
+
+    std::string Escape(const std::string& str)
+    {
+        std::ostringstream res;
+        for (unsigned char c: str) {
+            switch (c) {
+                case '\\':
+                    res << "\\\\";
+                    break;
+                case '\t':
+                    res << "\\t";
+                    break;
+                case '\n':
+                    res << "\\n";
+                    break;
+                default:
+                    if (c < 0x20 || c == 0x7f) {
+                        res << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c)
+                            << std::dec;
+                    } else {
+                        res << c;
+                    }
+            }
+        }
+        return res.str();
+    }
+
+    std::string Unescape(const std::string& str)
+    {
+        std::string res;
+        for (size_t i = 0; i < str.size(); ++i) {
+            if (str[i] != '\\') {
+                res.push_back(str[i]);
+                continue;
+            }
+            if (++i == str.size()) {
+                throw std::runtime_error("bad escape sequence: " + str);
+            }
+            switch (str[i]) {
+                case '\\':
+                    res.push_back('\\');
+                    break;
+                case 't':
+                    res.push_back('\t');
+                    break;
+                case 'n':
+                    res.push_back('\n');
+                    break;
+                case 'x':
+                    if (i + 2 >= str.size()) {
+                        throw std::runtime_error("bad escape sequence: " + str);
+                    }
+                    res.push_back(static_cast<char>(std::stoi(str.substr(i + 1, 2), nullptr, 16)));
+                    i += 2;
+                    break;
+                default:
+                    throw std::runtime_error("bad escape sequence: " + str);
+            }
+        }
+        return res;
+    }
+
+    std::vector<std::string> SplitFields(const std::string& line)
+    {
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t')) {
+            fields.push_back(field);
+        }
+        // getline doesn't return trailing empty field
+        if (!line.empty() && line.back() == '\t') {
+            fields.emplace_back();
+        }
+        return fields;
+    }
+}
+
+TRecordingSysfsBackend::TRecordingSysfsBackend(PSysfsBackend backend, const std::string& traceFile)
+    : Backend(backend ? backend : std::make_shared<TPlainSysfsBackend>()),
+      TraceStart(steady_clock::now())
+{
+    OpenWithException(Trace, traceFile);
+    Trace << TRACE_HEADER << std::endl;
+}
+
+void TRecordingSysfsBackend::ListDir(const std::string& dir, std::vector<std::string>& entries)
+{
+    auto start = steady_clock::now();
+    try {
+        Backend->ListDir(dir, entries);
+    } catch (const TNoDirError&) {
+        Write(start, LIST_DIR_OP, dir, false, std::string());
+        throw;
+    }
+    std::string data;
+    for (const auto& entry: entries) {
+        if (!data.empty()) {
+            data.push_back(ENTRIES_SEPARATOR);
+        }
+        data += entry;
+    }
+    Write(start, LIST_DIR_OP, dir, true, data);
+}
+
+bool TRecordingSysfsBackend::Exists(const std::string& path)
+{
+    auto start = steady_clock::now();
+    auto res = Backend->Exists(path);
+    Write(start, EXISTS_OP, path, res, std::string());
+    return res;
+}
+
+bool TRecordingSysfsBackend::ReadFile(const std::string& path, std::string& content)
+{
+    auto start = steady_clock::now();
+    auto res = Backend->ReadFile(path, content);
+    Write(start, READ_FILE_OP, path, res, res ? content : std::string());
+    return res;
+}
+
+bool TRecordingSysfsBackend::WriteFile(const std::string& path, const std::string& data)
+{
+    auto start = steady_clock::now();
+    auto res = Backend->WriteFile(path, data);
+    Write(start, WRITE_FILE_OP, path, res, data);
+    return res;
+}
+
+void TRecordingSysfsBackend::ReadFiles(std::vector<TSysfsReadRequest>& requests)
+{
+    if (requests.empty()) {
+        return;
+    }
+    auto start = steady_clock::now();
+    Backend->ReadFiles(requests);
+    auto duration = duration_cast<microseconds>(steady_clock::now() - start) / requests.size();
+    for (const auto& request: requests) {
+        Write(start, duration, READ_FILE_OP, request.Path, request.Ok, request.Ok ? request.Content : std::string());
+    }
+}
+
+void TRecordingSysfsBackend::Write(steady_clock::time_point start,
+                                   char op,
+                                   const std::string& path,
+                                   bool ok,
+                                   const std::string& data)
+{
+    Write(start, duration_cast<microseconds>(steady_clock::now() - start), op, path, ok, data);
+}
+
+void TRecordingSysfsBackend::Write(steady_clock::time_point start,
+                                   microseconds duration,
+                                   char op,
+                                   const std::string& path,
+                                   bool ok,
+                                   const std::string& data)
+{
+    std::unique_lock<std::mutex> lk(Mutex);
+    Trace << duration_cast<microseconds>(start - TraceStart).count() << '\t' << duration.count() << '\t' << op
+          << '\t' << Escape(path) << '\t' << (ok ? 1 : 0) << '\t' << Escape(data) << '\n';
+    Trace.flush();
+}
+
+TReplaySysfsBackend::TReplaySysfsBackend(const std::string& traceFile, double speed): Speed(speed)
+{
+    std::ifstream trace;
+    OpenWithException(trace, traceFile);
+    std::string line;
+    std::getline(trace, line);
+    if (line != TRACE_HEADER) {
+        throw std::runtime_error("unsupported sysfs trace format: " + traceFile);
+    }
+    size_t lineNumber = 1;
+    while (std::getline(trace, line)) {
+        ++lineNumber;
+        if (line.empty()) {
+            continue;
+        }
+        auto fields = SplitFields(line);
+        try {
+            if (fields.size() != 6 || fields[2].size() != 1) {
+                throw std::runtime_error("wrong number of fields");
+            }
+            TRecord record{microseconds(std::stoll(fields[1])), fields[4] == "1", Unescape(fields[5])};
+            Records[fields[2] + Unescape(fields[3])].Records.push_back(std::move(record));
+        } catch (const std::exception& e) {
+            throw std::runtime_error("malformed sysfs trace " + traceFile + ":" + std::to_string(lineNumber) + ": " +
+                                     e.what());
+        }
+    }
+}
+
+TReplaySysfsBackend::TRecord TReplaySysfsBackend::GetNextRecord(char op, const std::string& path)
+{
+    std::unique_lock<std::mutex> lk(Mutex);
+    auto it = Records.find(op + path);
+    if (it == Records.end()) {
+        throw std::runtime_error(std::string("request is not recorded: ") + op + " " + path);
+    }
+    auto& records = it->second;
+    auto record = records.Records[std::min(records.Next, records.Records.size() - 1)];
+    ++records.Next;
+    return record;
+}
+
+void TReplaySysfsBackend::Wait(microseconds duration) const
+{
+    if (Speed > 0) {
+        std::this_thread::sleep_for(duration_cast<microseconds>(duration / Speed));
+    }
+}
+
+TReplaySysfsBackend::TRecord TReplaySysfsBackend::Replay(char op, const std::string& path)
+{
+    auto record = GetNextRecord(op, path);
+    Wait(record.Duration);
+    return record;
+}
+
+void TReplaySysfsBackend::ListDir(const std::string& dir, std::vector<std::string>& entries)
+{
+    auto record = Replay(LIST_DIR_OP, dir);
+    if (!record.Ok) {
+        throw TNoDirError("Can't open directory: " + dir);
+    }
+    entries.clear();
+    std::stringstream ss(record.Data);
+    std::string entry;
+    while (std::getline(ss, entry, ENTRIES_SEPARATOR)) {
+        entries.push_back(entry);
+    }
+}
+
+bool TReplaySysfsBackend::Exists(const std::string& path)
+{
+    return Replay(EXISTS_OP, path).Ok;
+}
+
+bool TReplaySysfsBackend::ReadFile(const std::string& path, std::string& content)
+{
+    auto record = Replay(READ_FILE_OP, path);
+    if (record.Ok) {
+        content = record.Data;
+    }
+    return record.Ok;
+}
+
+// Written data is not checked, a replayed run may configure devices differently than the recorded one
+bool TReplaySysfsBackend::WriteFile(const std::string& path, const std::string&)
+{
+    return Replay(WRITE_FILE_OP, path).Ok;
+}
+
+void TReplaySysfsBackend::ReadFiles(std::vector<TSysfsReadRequest>& requests)
+{
+    microseconds duration(0);
+    for (auto& request: requests) {
+        auto record = GetNextRecord(READ_FILE_OP, request.Path);
+        request.Ok = record.Ok;
+        if (record.Ok) {
+            request.Content = record.Data;
+        }
+        duration += record.Duration;
+    }
+    Wait(duration);
+}
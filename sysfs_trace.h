@@ -0,0 +1,116 @@
+#pragma once
+
+#include "sysfs_backend.h"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * @brief Sysfs access which passes all requests to another backend and writes them to a trace file.
+ *        Every line of the trace holds start time and duration of a request in microseconds,
+ *        operation (L - ListDir, E - Exists, R - ReadFile, W - WriteFile), path, result and data.
+ *        Files of a ReadFiles batch are recorded as ReadFile requests with equal shares of the batch duration,
+ *        so the batch takes recorded time on replay by single ReadFile calls as well as by ReadFiles.
+ *
+ */
+class TRecordingSysfsBackend: public ISysfsBackend
+{
+public:
+    /**
+     * @brief Construct a new TRecordingSysfsBackend object. Throws std::runtime_error if trace file can't be opened.
+     *
+     * @param backend backend to pass requests to, nullptr - plain system calls
+     * @param traceFile file to write the trace to, it is overwritten
+     */
+    TRecordingSysfsBackend(PSysfsBackend backend, const std::string& traceFile);
+
+    void ListDir(const std::string& dir, std::vector<std::string>& entries) override;
+    bool Exists(const std::string& path) override;
+    bool ReadFile(const std::string& path, std::string& content) override;
+    bool WriteFile(const std::string& path, const std::string& data) override;
+    void ReadFiles(std::vector<TSysfsReadRequest>& requests) override;
+
+private:
+    void Write(std::chrono::steady_clock::time_point start,
+               char op,
+               const std::string& path,
+               bool ok,
+               const std::string& data);
+
+    void Write(std::chrono::steady_clock::time_point start,
+               std::chrono::microseconds duration,
+               char op,
+               const std::string& path,
+               bool ok,
+               const std::string& data);
+
+    PSysfsBackend Backend;
+    std::ofstream Trace;
+    std::chrono::steady_clock::time_point TraceStart;
+    std::mutex Mutex;
+};
+
+/**
+ * @brief Sysfs access which answers requests with results from a trace written by TRecordingSysfsBackend.
+ *        Requests to the same path and of the same kind get recorded results in recorded order,
+ *        the last result is repeated after the end of recording.
+ *        The real sysfs is not touched.
+ *
+ */
+class TReplaySysfsBackend: public ISysfsBackend
+{
+public:
+    /**
+     * @brief Construct a new TReplaySysfsBackend object. Throws std::runtime_error if trace file is malformed.
+     *
+     * @param traceFile trace written by TRecordingSysfsBackend
+     * @param speed replay speed, requests take recorded time divided by speed, 0 - no delays
+     */
+    TReplaySysfsBackend(const std::string& traceFile, double speed = 1.0);
+
+    void ListDir(const std::string& dir, std::vector<std::string>& entries) override;
+    bool Exists(const std::string& path) override;
+    bool ReadFile(const std::string& path, std::string& content) override;
+    bool WriteFile(const std::string& path, const std::string& data) override;
+
+    /**
+     * @brief Replay files of a batch and wait once for the sum of their recorded durations
+     */
+    void ReadFiles(std::vector<TSysfsReadRequest>& requests) override;
+
+private:
+    struct TRecord
+    {
+        std::chrono::microseconds Duration;
+        bool Ok;
+        std::string Data;
+    };
+
+    struct TRecords
+    {
+        std::vector<TRecord> Records;
+        size_t Next = 0;
+    };
+
+    /**
+     * @brief Get next recorded result of a request and wait for its recorded duration.
+     *        Throws std::runtime_error if the request was not recorded.
+     */
+    TRecord Replay(char op, const std::string& path);
+
+    /**
+     * @brief Get next recorded result of a request without waiting.
+     *        Throws std::runtime_error if the request was not recorded.
+     */
+    TRecord GetNextRecord(char op, const std::string& path);
+
+    void Wait(std::chrono::microseconds duration) const;
+
+    double Speed;
+
+    //! Key is operation character followed by path
+    std::unordered_map<std::string, TRecords> Records;
+    std::mutex Mutex;
+};
@@ -1,10 +1,10 @@
 #include "sysfs_w1.h"
 
-#include "file_utils.h"
 #include <algorithm>
-#include <fcntl.h>
-#include <fstream>
-#include <unistd.h>
+#include <cctype>
+#include <charconv>
+#include <fnmatch.h>
+#include <limits>
 #include <wblib/utils.h>
 
 using namespace std::chrono;
@@ -14,17 +14,39 @@ using namespace std::chrono;
 namespace
 {
     const char BULK_CONVERSION_TRIGGER[] = "trigger";
+
+    // Trailing zero is written too
+    const std::string BULK_CONVERSION_TRIGGER_DATA(BULK_CONVERSION_TRIGGER, sizeof(BULK_CONVERSION_TRIGGER));
+
+    // w1_master_search values: 0 - kernel search is stopped, N - perform N searches
+    const auto NO_SEARCH = "0";
+    const auto SINGLE_SEARCH = "1";
+
+    // w1_master_slaves content if there are no devices on the bus
+    const auto NO_SLAVES = "not found.";
     const auto MAX_CONVERSION_TIME = milliseconds(2000);
+
+    // Thermometer is not read in any round of w1_slave entries reading
+    const auto NO_ROUND = std::numeric_limits<size_t>::max();
+
+    // Bus status polling interval until conversion time of the bus is learned
+    const auto UNKNOWN_CONVERSION_CHECK_INTERVAL = milliseconds(100);
+
+    // Bus status polling interval if conversion is not completed at expected time
+    const auto CONVERSION_CHECK_INTERVAL = milliseconds(20);
+
+    // First status check is done a bit earlier than expected completion, so the estimate can go down
+    const auto FIRST_CHECK_RATIO = 0.95;
+    const auto CONVERSION_TIME_SMOOTHING = 0.2;
+    const auto MIN_CONVERSION_TIME_SAMPLES = 5;
+    const auto CONVERSION_TIME_GROWTH_RATIO = 1.5;
     const auto MAX_VALUE_CHANGE = 10 * 1000;    // 1 degree per second for DEFAULT_POLL_INTERVALL_MS
     const auto MEASUREMENT_ERROR_VALUE = 85000; // sensor power on temperature value (read without conversion)
     const auto MEASUREMENT_MAX_VALUE = 127937;  // max possible temperature value (for some chineese clones)
 
-    std::unordered_map<std::string, int> lastValueMap;
-
     template<class T, class Pred> void erase_if(T& c, Pred pred)
     {
-        auto last = c.end();
-        for (auto i = c.begin(); i != last;) {
+        for (auto i = c.begin(); i != c.end();) {
             if (pred(*i)) {
                 i = c.erase(i);
             } else {
@@ -33,72 +55,94 @@ namespace
         }
     }
 
-    std::string ReadLine(const std::string& fileName)
+    PSysfsBackend GetBackend(const PSysfsBackend& backend)
     {
-        std::ifstream file;
-        OpenWithException(file, fileName);
-        std::string str;
-        std::getline(file, str);
-        return str;
+        static auto plainBackend = std::make_shared<TPlainSysfsBackend>();
+        return backend ? backend : plainBackend;
     }
 
-    bool RunBulkRead(const std::string& fileName, WBMQTT::TLogger& logger)
+    std::string_view GetFirstLine(std::string_view content)
     {
-        auto fd = open(fileName.c_str(), O_WRONLY | O_APPEND);
-        if (fd < 0) {
-            LOG(logger) << "Can't open file:" << fileName;
-            return false;
+        return content.substr(0, content.find('\n'));
+    }
+
+    std::string ReadLine(ISysfsBackend& backend, const std::string& fileName)
+    {
+        std::string content;
+        if (!backend.ReadFile(fileName, content)) {
+            throw std::runtime_error("Can't open file:" + fileName);
         }
-        auto s = write(fd, BULK_CONVERSION_TRIGGER, sizeof(BULK_CONVERSION_TRIGGER)); // Write trailing zero
-        close(fd);
-        return (s == sizeof(BULK_CONVERSION_TRIGGER));
+        return std::string(GetFirstLine(content));
     }
 
-    double GetTemperatureFromString(const std::string& str, const std::string& deviceFileName)
+    bool RunBulkRead(ISysfsBackend& backend, const std::string& fileName, WBMQTT::TLogger& logger)
     {
-        if (str.empty()) {
-            throw TOneWireReadErrorException("Can't read temperature", deviceFileName);
+        if (!backend.WriteFile(fileName, BULK_CONVERSION_TRIGGER_DATA)) {
+            LOG(logger) << "Can't write file:" << fileName;
+            return false;
         }
+        return true;
+    }
 
-        int dataInt = std::stoi(str.c_str());
+    double GetTemperatureFromString(std::string_view str,
+                                    const std::string& deviceFileName,
+                                    std::optional<int>& lastValue)
+    {
+        // Parse like std::stoi, but without allocations
+        auto begin = str.data();
+        auto end = str.data() + str.size();
+        while (begin != end && std::isspace(static_cast<unsigned char>(*begin))) {
+            ++begin;
+        }
+        if (begin != end && *begin == '+') {
+            ++begin;
+        }
+        int dataInt;
+        if (std::from_chars(begin, end, dataInt).ec != std::errc()) {
+            throw TOneWireReadErrorException(TOneWireReadErrorException::ReadError, deviceFileName);
+        }
 
         // Thermometer can't measure temperature?
         if (dataInt == MEASUREMENT_ERROR_VALUE) {
-            auto it = lastValueMap.find(deviceFileName);
-            if (it == lastValueMap.end() || abs(dataInt - it->second) > MAX_VALUE_CHANGE) {
-                throw TOneWireReadErrorException("Measurement error", deviceFileName);
+            if (!lastValue || abs(dataInt - *lastValue) > MAX_VALUE_CHANGE) {
+                throw TOneWireReadErrorException(TOneWireReadErrorException::MeasurementError, deviceFileName);
             }
         }
 
         // returned max possible temp, probably an error (it happens for chineese clones)
         if (dataInt == MEASUREMENT_MAX_VALUE) {
-            throw TOneWireReadErrorException("Thermometer error", deviceFileName);
+            throw TOneWireReadErrorException(TOneWireReadErrorException::ThermometerError, deviceFileName);
         }
 
-        lastValueMap[deviceFileName] = dataInt;
+        lastValue = dataInt;
         return dataInt / 1000.0; // Temperature given by kernel is in thousandths of degrees
     }
 
-    double GetBulkReadTemperature(const std::string& deviceFileName)
+    double GetBulkReadTemperature(std::string_view content,
+                                  const std::string& deviceFileName,
+                                  std::optional<int>& lastValue)
     {
-        return GetTemperatureFromString(ReadLine(deviceFileName), deviceFileName);
+        return GetTemperatureFromString(GetFirstLine(content), deviceFileName, lastValue);
     }
 
-    double GetDirectConvertedTemperature(const std::string& deviceFileName)
+    double GetDirectConvertedTemperature(std::string_view content,
+                                         const std::string& deviceFileName,
+                                         std::optional<int>& lastValue)
     {
-        std::string data;
+        std::string_view data;
         bool crcOk = false;
 
-        const std::string tag("t=");
-
-        std::ifstream file;
-        OpenWithException(file, deviceFileName);
+        const std::string_view tag("t=");
 
         /*  reading file till eof could lead to a stuck
-            when device is removed */
-        while (file.good()) {
-            std::string sLine;
-            std::getline(file, sLine);
+            when device is removed, so the backend stops on first read error */
+        for (size_t lineStart = 0; lineStart < content.size();) {
+            auto lineEnd = content.find('\n', lineStart);
+            if (lineEnd == std::string::npos) {
+                lineEnd = content.size();
+            }
+            auto sLine = content.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
             if (sLine.find("crc=") != std::string::npos) {
                 if (sLine.find("YES") != std::string::npos) {
                     crcOk = true;
@@ -112,38 +156,85 @@ namespace
         }
 
         if (!crcOk) {
-            throw TOneWireReadErrorException("Bad CRC", deviceFileName);
+            throw TOneWireReadErrorException(TOneWireReadErrorException::CrcError, deviceFileName);
         }
 
-        return GetTemperatureFromString(data, deviceFileName);
+        return GetTemperatureFromString(data, deviceFileName, lastValue);
     }
 
-    struct TBusMaster
+    bool MatchAny(const std::vector<std::string>& patterns, const std::string& name)
     {
-        std::string Dir;
-        bool SupportsBulkRead;
-    };
+        return patterns.empty() || std::any_of(patterns.begin(), patterns.end(), [&](const auto& pattern) {
+                   return fnmatch(pattern.c_str(), name.c_str(), 0) == 0;
+               });
+    }
+
+    // Devices are ordered by ROM codes. Identifier codes are compared only if ROM codes are equal,
+    // i.e. for the same device or for identifiers not in kernel format, see ParseRomCode
+    template<class T> bool DeviceLess(const T& device, uint64_t romCode, const std::string& id)
+    {
+        return device->GetRomCode() < romCode || (device->GetRomCode() == romCode && device->GetId() < id);
+    }
+
+    template<class TDevices> auto LowerBound(TDevices& devices, uint64_t romCode, const std::string& id)
+    {
+        return std::lower_bound(devices.begin(), devices.end(), romCode, [&](const auto& device, uint64_t code) {
+            return DeviceLess(device, code, id);
+        });
+    }
+
+    template<class TDevices, class TIterator> bool IsFound(TDevices& devices, TIterator it, const std::string& id)
+    {
+        return it != devices.end() && (*it)->GetId() == id;
+    }
+
+    void SortByPriority(std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& devices)
+    {
+        std::sort(devices.begin(), devices.end(), [](const auto& v1, const auto& v2) {
+            if (v1->GetPriority() != v2->GetPriority()) {
+                return v1->GetPriority() > v2->GetPriority();
+            }
+            return DeviceLess(v1, v2->GetRomCode(), v2->GetId());
+        });
+    }
 }
 
-TSysfsOneWireThermometer::TSysfsOneWireThermometer(const std::string& id, const std::string& dir, bool bulkRead)
+TSysfsOneWireThermometer::TSysfsOneWireThermometer(const std::string& id,
+                                                   const std::string& dir,
+                                                   bool bulkRead,
+                                                   PSysfsBackend backend)
     : Id(id),
+      RomCode(ParseRomCode(id).value_or(0)),
       Status(TSysfsOneWireThermometer::New),
-      BulkRead(bulkRead)
+      BulkRead(bulkRead),
+      Backend(GetBackend(backend)),
+      Priority(0),
+      Prefetched(false)
 {
     SetDeviceFileName(dir);
 }
 
 void TSysfsOneWireThermometer::SetDeviceFileName(const std::string& dir)
 {
+    BusDir = dir;
     DeviceFileName = dir + "/" + Id + (BulkRead ? "/temperature" : "/w1_slave");
+    Prefetched = false;
 }
 
 double TSysfsOneWireThermometer::GetTemperature() const
 {
+    SampleTime = steady_clock::time_point();
+    if (!Prefetched && !Backend->ReadFile(DeviceFileName, ReadBuffer)) {
+        throw TOneWireReadErrorException(TOneWireReadErrorException::OpenError, DeviceFileName);
+    }
     if (BulkRead) {
-        return GetBulkReadTemperature(DeviceFileName);
+        Prefetched = false;
+        SampleTime = ConversionCompleteTime;
+        return GetBulkReadTemperature(ReadBuffer, DeviceFileName, LastValue);
     }
-    return GetDirectConvertedTemperature(DeviceFileName);
+    SampleTime = Prefetched ? PrefetchTime : steady_clock::now();
+    Prefetched = false;
+    return GetDirectConvertedTemperature(ReadBuffer, DeviceFileName, LastValue);
 }
 
 const std::string& TSysfsOneWireThermometer::GetId() const
@@ -151,11 +242,51 @@ const std::string& TSysfsOneWireThermometer::GetId() const
     return Id;
 }
 
+uint64_t TSysfsOneWireThermometer::GetRomCode() const
+{
+    return RomCode;
+}
+
+const std::string& TSysfsOneWireThermometer::GetDeviceFileName() const
+{
+    return DeviceFileName;
+}
+
+void TSysfsOneWireThermometer::SetPrefetchedContent(std::string& content, steady_clock::time_point readTime)
+{
+    ReadBuffer.swap(content);
+    Prefetched = true;
+    PrefetchTime = readTime;
+}
+
+void TSysfsOneWireThermometer::SetConversionCompleteTime(steady_clock::time_point time)
+{
+    ConversionCompleteTime = time;
+}
+
+steady_clock::time_point TSysfsOneWireThermometer::GetSampleTime() const
+{
+    return SampleTime;
+}
+
+const std::string& TSysfsOneWireThermometer::GetBusDir() const
+{
+    return BusDir;
+}
+
 TSysfsOneWireThermometer::PresenceStatus TSysfsOneWireThermometer::GetStatus() const
 {
     return Status;
 }
 
+void TSysfsOneWireThermometer::SetBulkRead(bool bulkRead)
+{
+    if (BulkRead != bulkRead) {
+        BulkRead = bulkRead;
+        SetDeviceFileName(BusDir);
+    }
+}
+
 void TSysfsOneWireThermometer::MarkAsDisconnected()
 {
     Status = Disconnected;
@@ -164,96 +295,758 @@ void TSysfsOneWireThermometer::MarkAsDisconnected()
 bool TSysfsOneWireThermometer::FoundAgain(const std::string& dir)
 {
     Status = Connected;
-    if (WBMQTT::StringStartsWith(DeviceFileName, dir)) {
+    if (BusDir == dir) {
         return true;
     }
     SetDeviceFileName(dir);
     return false;
 }
 
+TWindowStatistics& TSysfsOneWireThermometer::GetStatistics()
+{
+    return Statistics;
+}
+
+bool TSysfsOneWireThermometer::IsBulkRead() const
+{
+    return BulkRead;
+}
+
+int TSysfsOneWireThermometer::GetPriority() const
+{
+    return Priority;
+}
+
+void TSysfsOneWireThermometer::SetPriority(int priority)
+{
+    Priority = priority;
+}
+
+TSysfsOneWireDevice::TSysfsOneWireDevice(const std::string& id, const std::string& dir, const TOneWireFamily& family)
+    : Id(id),
+      RomCode(ParseRomCode(id).value_or(0)),
+      Family(family),
+      Status(TSysfsOneWireThermometer::New),
+      Values(family.Channels.size())
+{
+    SetBusDir(dir);
+}
+
+void TSysfsOneWireDevice::SetBusDir(const std::string& dir)
+{
+    BusDir = dir;
+    AttributePaths.clear();
+    for (const auto& attribute: Family.Attributes) {
+        AttributePaths.push_back(dir + "/" + Id + "/" + attribute);
+    }
+}
+
+const std::string& TSysfsOneWireDevice::GetId() const
+{
+    return Id;
+}
+
+uint64_t TSysfsOneWireDevice::GetRomCode() const
+{
+    return RomCode;
+}
+
+const std::string& TSysfsOneWireDevice::GetBusDir() const
+{
+    return BusDir;
+}
+
+const TOneWireFamily& TSysfsOneWireDevice::GetFamily() const
+{
+    return Family;
+}
+
+const std::vector<std::string>& TSysfsOneWireDevice::GetAttributePaths() const
+{
+    return AttributePaths;
+}
+
+void TSysfsOneWireDevice::SetValues(const TSysfsReadRequest* attributes)
+{
+    Family.Parse(attributes, Values.data());
+}
+
+const std::vector<std::optional<double>>& TSysfsOneWireDevice::GetValues() const
+{
+    return Values;
+}
+
+TSysfsOneWireThermometer::PresenceStatus TSysfsOneWireDevice::GetStatus() const
+{
+    return Status;
+}
+
+void TSysfsOneWireDevice::MarkAsDisconnected()
+{
+    Status = TSysfsOneWireThermometer::Disconnected;
+}
+
+bool TSysfsOneWireDevice::FoundAgain(const std::string& dir)
+{
+    Status = TSysfsOneWireThermometer::Connected;
+    if (BusDir == dir) {
+        return true;
+    }
+    SetBusDir(dir);
+    return false;
+}
+
 TSysfsOneWireManager::TSysfsOneWireManager(const std::string& devicesDir,
                                            WBMQTT::TLogger& debugLogger,
-                                           WBMQTT::TLogger& errorLogger)
+                                           WBMQTT::TLogger& errorLogger,
+                                           const TCancellationToken* cancellationToken,
+                                           PSysfsBackend backend)
     : DevicesDir(devicesDir),
       DebugLogger(debugLogger),
-      ErrorLogger(errorLogger)
+      ErrorLogger(errorLogger),
+      CancellationToken(cancellationToken),
+      Backend(GetBackend(backend)),
+      ExplicitSearch(false),
+      BatchRead(false),
+      BulkConversion(true),
+      SynchronizedConversion(false),
+      TriggerSkew(microseconds::zero()),
+      Rescanning(false)
 {}
 
-std::vector<std::shared_ptr<TSysfsOneWireThermometer>> TSysfsOneWireManager::RescanBusAndRead()
+TSysfsOneWireManager::~TSysfsOneWireManager()
 {
-    const auto prefixes = {"28-", "10-", "22-"};
-    erase_if(Devices, [](const auto& it) { return it.second->GetStatus() == TSysfsOneWireThermometer::Disconnected; });
+    RestoreKernelSearch();
+}
+
+const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& TSysfsOneWireManager::RescanBusAndRead()
+{
+    StartRescan();
+    WaitForConversion();
+    return CompleteRead();
+}
+
+void TSysfsOneWireManager::StartRescan()
+{
+    std::erase_if(Devices, [](const auto& d) { return d->GetStatus() == TSysfsOneWireThermometer::Disconnected; });
     for (auto& d: Devices) {
-        d.second->MarkAsDisconnected();
+        d->MarkAsDisconnected();
+    }
+    std::erase_if(GenericDevices,
+                  [](const auto& d) { return d->GetStatus() == TSysfsOneWireThermometer::Disconnected; });
+    for (auto& d: GenericDevices) {
+        d->MarkAsDisconnected();
+    }
+    for (auto& bm: BusMasters) {
+        bm.Found = false;
     }
 
-    std::vector<TBusMaster> busMasters;
+    // Known bus masters are updated in place, so steady state polling doesn't allocate memory
+    Backend->ListDir(DevicesDir, BusMasterNames);
+    for (const auto& busMasterName: BusMasterNames) {
+        if (!WBMQTT::StringStartsWith(busMasterName, "w1_bus_master") || !Filter.MatchBusMaster(busMasterName)) {
+            continue;
+        }
+        auto bm =
+            std::find_if(BusMasters.begin(), BusMasters.end(), [&](const auto& b) { return b.Name == busMasterName; });
+        bool newBusMaster = (bm == BusMasters.end());
+        if (newBusMaster) {
+            bm = BusMasters.emplace(BusMasters.end());
+            bm->Name = busMasterName;
+            bm->Dir = DevicesDir + busMasterName;
+            bm->BulkReadPath = bm->Dir + "/therm_bulk_read";
+            bm->SlavesPath = bm->Dir + "/w1_master_slaves";
+            bm->SearchPath = bm->Dir + "/w1_master_search";
+        }
+        bm->Found = true;
+        bm->SupportsBulkRead = Backend->Exists(bm->BulkReadPath);
+        if (ExplicitSearch) {
+            StopKernelSearch(*bm);
+        }
+        ListSensors(*bm);
 
-    IterateDir(DevicesDir, [&](const auto& name) {
-        if (!WBMQTT::StringStartsWith(name, "w1_bus_master")) {
-            return false;
+        if (newBusMaster || bm->SensorIds != ScannedSensorIds) {
+            bm->SensorIds = ScannedSensorIds;
+            bm->ConversionTime = milliseconds::zero();
+            bm->ConversionTimeSamples = 0;
+            DetectPowerMode(*bm);
         }
-        TBusMaster bm;
-        bm.Dir = DevicesDir + name;
-        bm.SupportsBulkRead = (access((bm.Dir + "/therm_bulk_read").c_str(), F_OK) == 0);
-        busMasters.push_back(bm);
-
-        if (bm.SupportsBulkRead) {
-            RunBulkRead(bm.Dir + "/therm_bulk_read", ErrorLogger);
-        }
-
-        IterateDir(bm.Dir, [&](const auto& name) {
-            for (const auto& prefix: prefixes) {
-                if (WBMQTT::StringStartsWith(name, prefix)) {
-                    auto it = Devices.find(name);
-                    if (it == Devices.end()) {
-                        it =
-                            Devices
-                                .insert({name,
-                                         std::make_shared<TSysfsOneWireThermometer>(name, bm.Dir, bm.SupportsBulkRead)})
-                                .first;
-                    } else {
-                        if (!it->second->FoundAgain(bm.Dir)) {
-                            LOG(DebugLogger) << name << " is switched to " << bm.Dir;
-                        }
-                    }
+        bm->BulkRead = BulkConversion && bm->SupportsBulkRead && (bm->PowerMode != ParasitePower);
+
+        for (const auto& id: bm->SensorIds) {
+            auto it = LowerBound(Devices, ParseRomCode(id).value_or(0), id);
+            if (!IsFound(Devices, it, id)) {
+                auto device = std::make_shared<TSysfsOneWireThermometer>(id, bm->Dir, bm->BulkRead, Backend);
+                device->SetPriority(GetPriority(id));
+                Devices.insert(it, device);
+            } else {
+                if (!(*it)->FoundAgain(bm->Dir)) {
+                    LOG(DebugLogger) << id << " is switched to " << bm->Dir;
                 }
+                (*it)->SetBulkRead(bm->BulkRead);
             }
-            return false;
-        });
-        return false;
-    });
+        }
+        for (const auto& id: ScannedDeviceIds) {
+            auto it = LowerBound(GenericDevices, ParseRomCode(id).value_or(0), id);
+            if (!IsFound(GenericDevices, it, id)) {
+                GenericDevices.insert(it, std::make_shared<TSysfsOneWireDevice>(id, bm->Dir, *FindOneWireFamily(id)));
+            } else if (!(*it)->FoundAgain(bm->Dir)) {
+                LOG(DebugLogger) << id << " is switched to " << bm->Dir;
+            }
+        }
+    }
+    erase_if(BusMasters, [](const auto& bm) { return !bm.Found; });
+
+    ScannedDevices.assign(Devices.begin(), Devices.end());
+    SortByPriority(ScannedDevices);
+
+    Rescanning = true;
+    StartConversions(nullptr);
+}
+
+const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& TSysfsOneWireManager::CompleteRead()
+{
+    SetConversionCompleteTimes();
+    PrefetchTemperatures(SynchronizedConversion ? BulkReadEntries : AllEntries);
+    if (Rescanning) {
+        ReadDevices();
+    }
+    return ScannedDevices;
+}
+
+const std::vector<std::shared_ptr<TSysfsOneWireDevice>>& TSysfsOneWireManager::GetDevices() const
+{
+    return ScannedGenericDevices;
+}
+
+void TSysfsOneWireManager::ReadDevices()
+{
+    ScannedGenericDevices.assign(GenericDevices.begin(), GenericDevices.end());
+    if (IsCancelled()) {
+        return;
+    }
 
-    auto time = steady_clock::now();
-    bool inConversion = true;
-    while (inConversion && (duration_cast<milliseconds>(steady_clock::now() - time) < MAX_CONVERSION_TIME)) {
-        inConversion = false;
-        for (auto& bm: busMasters) {
-            if (bm.SupportsBulkRead) {
-                try {
-                    auto status = ReadLine(bm.Dir + "/therm_bulk_read");
-                    inConversion |= (status.empty() || status[0] != '1');
-                } catch (const std::exception& e) {
-                    LOG(ErrorLogger) << e.what();
+    // All attributes of all devices are read in one batch
+    size_t count = 0;
+    for (const auto& device: ScannedGenericDevices) {
+        if (device->GetStatus() == TSysfsOneWireThermometer::Disconnected) {
+            continue;
+        }
+        for (const auto& path: device->GetAttributePaths()) {
+            if (count == DeviceReadRequests.size()) {
+                DeviceReadRequests.emplace_back();
+            }
+            DeviceReadRequests[count++].Path = path;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    DeviceReadRequests.resize(count);
+    Backend->ReadFiles(DeviceReadRequests);
+    auto request = DeviceReadRequests.data();
+    for (const auto& device: ScannedGenericDevices) {
+        if (device->GetStatus() != TSysfsOneWireThermometer::Disconnected) {
+            device->SetValues(request);
+            request += device->GetAttributePaths().size();
+        }
+    }
+}
+
+void TSysfsOneWireManager::ListSensors(const TBusMaster& bm)
+{
+    // w1_master_slaves holds the list of devices found by the kernel, so the bus directory is not walked
+    size_t count = 0;
+    if (Backend->ReadFile(bm.SlavesPath, ReadBuffer)) {
+        std::string_view slaves(ReadBuffer);
+        size_t lineStart = 0;
+        while (lineStart < slaves.size()) {
+            auto lineEnd = std::min(slaves.find('\n', lineStart), slaves.size());
+            AssignEntry(DirEntries, count++, slaves.substr(lineStart, lineEnd - lineStart));
+            lineStart = lineEnd + 1;
+        }
+        DirEntries.resize(count);
+    } else {
+        // Old kernels and test setups
+        Backend->ListDir(bm.Dir, DirEntries);
+    }
+    count = 0;
+    size_t deviceCount = 0;
+    for (const auto& name: DirEntries) {
+        if (name == NO_SLAVES || !Filter.MatchSensorId(name)) {
+            continue;
+        }
+        auto family = FindOneWireFamily(name);
+        if (!family) {
+            continue;
+        }
+        if (family->Thermometer) {
+            AssignEntry(ScannedSensorIds, count++, name);
+        } else {
+            AssignEntry(ScannedDeviceIds, deviceCount++, name);
+        }
+    }
+    ScannedSensorIds.resize(count);
+    std::sort(ScannedSensorIds.begin(), ScannedSensorIds.end());
+    ScannedDeviceIds.resize(deviceCount);
+}
+
+void TSysfsOneWireManager::SetExplicitSearch(bool explicitSearch)
+{
+    ExplicitSearch = explicitSearch;
+    if (!ExplicitSearch) {
+        RestoreKernelSearch();
+    }
+}
+
+void TSysfsOneWireManager::StopKernelSearch(const TBusMaster& bm)
+{
+    if (KernelSearchSettings.count(bm.Dir)) {
+        return;
+    }
+    const auto& fileName = bm.SearchPath;
+    std::string searchSetting;
+    try {
+        searchSetting = ReadLine(*Backend, fileName);
+    } catch (const std::exception& e) {
+        LOG(ErrorLogger) << e.what();
+        return;
+    }
+    if (!Backend->WriteFile(fileName, NO_SEARCH)) {
+        LOG(ErrorLogger) << "Can't write file:" << fileName;
+        return;
+    }
+    KernelSearchSettings[bm.Dir] = searchSetting;
+    LOG(DebugLogger) << "Kernel search is stopped on " << bm.Dir << " (was " << searchSetting << ")";
+}
+
+void TSysfsOneWireManager::RestoreKernelSearch()
+{
+    for (const auto& setting: KernelSearchSettings) {
+        auto fileName = setting.first + "/w1_master_search";
+        if (!Backend->WriteFile(fileName, setting.second)) {
+            LOG(ErrorLogger) << "Can't write file:" << fileName;
+        }
+    }
+    KernelSearchSettings.clear();
+}
+
+void TSysfsOneWireManager::TriggerSearch()
+{
+    if (!ExplicitSearch) {
+        return;
+    }
+    for (const auto& bm: BusMasters) {
+        if (KernelSearchSettings.count(bm.Dir) && !Backend->WriteFile(bm.SearchPath, SINGLE_SEARCH)) {
+            LOG(ErrorLogger) << "Can't write file:" << bm.SearchPath;
+        }
+    }
+}
+
+void TSysfsOneWireManager::SetBatchRead(bool batchRead)
+{
+    BatchRead = batchRead;
+}
+
+void TSysfsOneWireManager::SetBulkConversion(bool bulkConversion)
+{
+    BulkConversion = bulkConversion;
+}
+
+void TSysfsOneWireManager::SetSynchronizedConversion(bool synchronizedConversion)
+{
+    SynchronizedConversion = synchronizedConversion;
+}
+
+microseconds TSysfsOneWireManager::GetTriggerSkew() const
+{
+    return TriggerSkew;
+}
+
+void TSysfsOneWireManager::StartConversions(const std::unordered_set<std::string>* busDirs)
+{
+    Conversions.clear();
+
+    // Devices discovery is completed, so nothing but triggers is done between the first and the last trigger
+    auto triggerStart = steady_clock::now();
+    ConversionDeadline = triggerStart + MAX_CONVERSION_TIME;
+    for (auto& bm: BusMasters) {
+        if (!busDirs || busDirs->count(bm.Dir)) {
+            StartBulkConversion(bm);
+        }
+    }
+    if (!SynchronizedConversion) {
+        return;
+    }
+    TriggerSkew = duration_cast<microseconds>(steady_clock::now() - triggerStart);
+
+    // Thermometers on buses without bulk conversion convert while their w1_slave entries are read.
+    // The entries are read right after the triggers only if the backend reads a batch concurrently,
+    // so the first thermometers of all such buses start conversion together with bulk converted buses.
+    // Sequential blocking reads would delay the start step by conversion time of every thermometer
+    if (BatchRead && !IsCancelled()) {
+        ReadDirectEntries(&triggerStart);
+    }
+    LOG(DebugLogger) << "Conversions are triggered within " << TriggerSkew.count() << " us";
+}
+
+void TSysfsOneWireManager::PrefetchTemperatures(TPrefetchEntries entries)
+{
+    // Values not read in batch are read by GetTemperature, so reading can be stopped at any point
+    if (!BatchRead || IsCancelled()) {
+        return;
+    }
+    if (entries == AllEntries) {
+        ReadDirectEntries(nullptr);
+    }
+    if (IsCancelled()) {
+        return;
+    }
+    auto selected = [](const auto& device) {
+        return device->GetStatus() != TSysfsOneWireThermometer::Disconnected && device->IsBulkRead();
+    };
+    size_t count = 0;
+    for (const auto& device: ScannedDevices) {
+        if (selected(device)) {
+            if (count == BatchReadRequests.size()) {
+                BatchReadRequests.emplace_back();
+            }
+            BatchReadRequests[count++].Path = device->GetDeviceFileName();
+        }
+    }
+    BatchReadRequests.resize(count);
+    Backend->ReadFiles(BatchReadRequests);
+    auto readTime = steady_clock::now();
+    auto request = BatchReadRequests.begin();
+    for (const auto& device: ScannedDevices) {
+        if (selected(device)) {
+            // Failed opens are reported by GetTemperature
+            if (request->Ok) {
+                device->SetPrefetchedContent(request->Content, readTime);
+            }
+            ++request;
+        }
+    }
+}
+
+void TSysfsOneWireManager::ReadDirectEntries(const steady_clock::time_point* triggerStart)
+{
+    // Thermometers of a bus convert one after another while their w1_slave entries are read.
+    // Every round reads one thermometer of every bus, so rounds can be read concurrently by the backend,
+    // and bulk conversions are checked between rounds
+    DirectReadRounds.assign(ScannedDevices.size(), NO_ROUND);
+    size_t rounds = 0;
+    for (const auto& bm: BusMasters) {
+        size_t round = 0;
+        for (size_t i = 0; i < ScannedDevices.size(); ++i) {
+            const auto& device = ScannedDevices[i];
+            if (device->GetStatus() != TSysfsOneWireThermometer::Disconnected && !device->IsBulkRead() &&
+                device->GetBusDir() == bm.Dir)
+            {
+                DirectReadRounds[i] = round++;
+            }
+        }
+        rounds = std::max(rounds, round);
+    }
+    if (DirectReadRequests.size() < rounds) {
+        DirectReadRequests.resize(rounds);
+    }
+    for (size_t round = 0; round < rounds && !IsCancelled(); ++round) {
+        auto& requests = DirectReadRequests[round];
+        size_t count = 0;
+        for (size_t i = 0; i < ScannedDevices.size(); ++i) {
+            if (DirectReadRounds[i] == round) {
+                if (count == requests.size()) {
+                    requests.emplace_back();
                 }
+                requests[count++].Path = ScannedDevices[i]->GetDeviceFileName();
             }
         }
-        if (inConversion) {
-            std::this_thread::sleep_for(milliseconds(100));
+        requests.resize(count);
+        if (triggerStart && round == 0) {
+            // The first thermometers of the buses start conversion when the batch is submitted
+            TriggerSkew = duration_cast<microseconds>(steady_clock::now() - *triggerStart);
+        }
+        Backend->ReadFiles(requests);
+        auto readTime = steady_clock::now();
+        auto request = requests.begin();
+        for (size_t i = 0; i < ScannedDevices.size(); ++i) {
+            if (DirectReadRounds[i] == round) {
+                if (request->Ok) {
+                    ScannedDevices[i]->SetPrefetchedContent(request->Content, readTime);
+                }
+                ++request;
+            }
         }
+        steady_clock::time_point nextCheck;
+        CheckConversions(nextCheck);
     }
-    if (inConversion) {
-        LOG(DebugLogger) << "Conversion takes too much time";
+}
+
+void TSysfsOneWireManager::SetPriorities(const std::unordered_map<std::string, int>& priorities)
+{
+    Priorities = priorities;
+    for (auto& d: Devices) {
+        d->SetPriority(GetPriority(d->GetId()));
     }
+}
+
+int TSysfsOneWireManager::GetPriority(const std::string& id) const
+{
+    auto it = Priorities.find(id);
+    return (it == Priorities.end()) ? 0 : it->second;
+}
+
+void TSysfsOneWireManager::SetConversionCompleteTimes()
+{
+    for (const auto& device: ScannedDevices) {
+        auto bm = std::find_if(BusMasters.begin(), BusMasters.end(), [&](const auto& b) {
+            return b.Dir == device->GetBusDir();
+        });
+        if (bm != BusMasters.end() && bm->BulkRead) {
+            device->SetConversionCompleteTime(bm->ConversionComplete);
+        }
+    }
+}
+
+void TSysfsOneWireManager::SetFilter(const TOneWireDeviceFilter& filter)
+{
+    Filter = filter;
+}
+
+const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& TSysfsOneWireManager::ReadBuses(
+    const std::unordered_set<std::string>& busDirs)
+{
+    StartReadBuses(busDirs);
+    WaitForConversion();
+    return CompleteRead();
+}
 
-    std::vector<std::shared_ptr<TSysfsOneWireThermometer>> res;
+void TSysfsOneWireManager::StartReadBuses(const std::unordered_set<std::string>& busDirs)
+{
+    ScannedDevices.clear();
     for (auto& d: Devices) {
-        res.push_back(d.second);
+        if (d->GetStatus() != TSysfsOneWireThermometer::Disconnected && busDirs.count(d->GetBusDir())) {
+            ScannedDevices.push_back(d);
+        }
+    }
+    SortByPriority(ScannedDevices);
+
+    Rescanning = false;
+    StartConversions(&busDirs);
+}
+
+std::shared_ptr<TSysfsOneWireThermometer> TSysfsOneWireManager::FindDevice(const std::string& id) const
+{
+    auto it = LowerBound(Devices, ParseRomCode(id).value_or(0), id);
+    if (!IsFound(Devices, it, id)) {
+        return nullptr;
+    }
+    return *it;
+}
+
+TSysfsOneWireManager::TBusPowerMode TSysfsOneWireManager::GetBusPowerMode(const std::string& busDir) const
+{
+    for (const auto& bm: BusMasters) {
+        if (bm.Dir == busDir) {
+            return bm.PowerMode;
+        }
+    }
+    return UnknownPower;
+}
+
+void TSysfsOneWireManager::DetectPowerMode(TBusMaster& bm)
+{
+    bm.PowerMode = UnknownPower;
+    for (const auto& id: bm.SensorIds) {
+        std::string extPower;
+        try {
+            extPower = ReadLine(*Backend, bm.Dir + "/" + id + "/ext_power");
+        } catch (const std::exception&) {
+            // Old kernels don't have ext_power entry
+            continue;
+        }
+        if (extPower == "0") {
+            bm.PowerMode = ParasitePower;
+            break;
+        }
+        if (extPower == "1") {
+            bm.PowerMode = ExternalPower;
+        }
+    }
+
+    if (bm.PowerMode != ParasitePower) {
+        return;
+    }
+    LOG(DebugLogger) << bm.Dir << " has parasite powered sensors, bulk conversion is disabled";
+    try {
+        // 0 - strong pullup is enabled, 1 - disabled
+        if (ReadLine(*Backend, bm.Dir + "/w1_master_pullup") == "1") {
+            LOG(ErrorLogger) << bm.Dir << " has parasite powered sensors, but strong pullup is disabled";
+        }
+    } catch (const std::exception&) {
+    }
+}
+
+void TSysfsOneWireManager::StartBulkConversion(TBusMaster& bm)
+{
+    if (!bm.BulkRead) {
+        return;
+    }
+    bm.ConversionStart = steady_clock::now();
+    RunBulkRead(*Backend, bm.BulkReadPath, ErrorLogger);
+
+    // Check close to expected completion time if it is known, otherwise check right away
+    auto firstCheckDelay = duration_cast<milliseconds>(bm.ConversionTime * FIRST_CHECK_RATIO);
+    Conversions.push_back({&bm, bm.ConversionStart + firstCheckDelay});
+}
+
+void TSysfsOneWireManager::WaitForConversion()
+{
+    steady_clock::time_point nextCheck;
+    while (!CheckConversions(nextCheck)) {
+        if (CancellationToken) {
+            if (CancellationToken->WaitUntil(nextCheck)) {
+                LOG(DebugLogger) << "Waiting for conversion is cancelled";
+                return;
+            }
+        } else {
+            std::this_thread::sleep_until(nextCheck);
+        }
+    }
+}
+
+bool TSysfsOneWireManager::CheckConversions(steady_clock::time_point& nextCheck)
+{
+    auto now = steady_clock::now();
+    erase_if(Conversions, [&](auto& c) {
+        if (c.NextCheck > now) {
+            return false;
+        }
+        auto bm = c.BusMaster;
+        if (!Backend->ReadFile(bm->BulkReadPath, ReadBuffer)) {
+            LOG(ErrorLogger) << "Can't open file:" << bm->BulkReadPath;
+            return true;
+        }
+        if (ReadBuffer.empty() || ReadBuffer[0] != '1') {
+            c.NextCheck = now + ((bm->ConversionTimeSamples != 0) ? CONVERSION_CHECK_INTERVAL
+                                                                 : UNKNOWN_CONVERSION_CHECK_INTERVAL);
+            return false;
+        }
+        if (now <= c.NextCheck + CONVERSION_CHECK_INTERVAL) {
+            bm->ConversionComplete = now;
+            UpdateConversionTime(*bm, duration_cast<milliseconds>(now - bm->ConversionStart), true);
+            return true;
+        }
+        // The check is delayed by reading of w1_slave entries, so the conversion could be completed long ago.
+        // Its duration is unknown and is not learned, but the values are not older than expected completion
+        bm->ConversionComplete = now;
+        if (bm->ConversionTimeSamples != 0) {
+            bm->ConversionComplete = std::min(now, bm->ConversionStart + bm->ConversionTime);
+        }
+        return true;
+    });
+    if (Conversions.empty()) {
+        return true;
+    }
+    nextCheck = std::min_element(Conversions.begin(), Conversions.end(), [](const auto& c1, const auto& c2) {
+                    return c1.NextCheck < c2.NextCheck;
+                })->NextCheck;
+    if (nextCheck <= ConversionDeadline) {
+        return false;
+    }
+    for (const auto& c: Conversions) {
+        // Values of unfinished conversion are read right away, so they are not older than that
+        c.BusMaster->ConversionComplete = now;
+
+        // The conversion took at least the whole wait, so the estimate grows
+        UpdateConversionTime(*c.BusMaster, duration_cast<milliseconds>(now - c.BusMaster->ConversionStart), false);
+    }
+    Conversions.clear();
+    return true;
+}
+
+void TSysfsOneWireManager::UpdateConversionTime(TBusMaster& bm, milliseconds conversionTime, bool completed)
+{
+    if (!completed) {
+        LOG(ErrorLogger) << bm.Dir << " conversion is not completed in " << conversionTime.count()
+                         << " ms, check bus wiring";
+    } else if (bm.ConversionTimeSamples >= MIN_CONVERSION_TIME_SAMPLES &&
+               conversionTime > bm.ConversionTime * CONVERSION_TIME_GROWTH_RATIO + CONVERSION_CHECK_INTERVAL)
+    {
+        LOG(ErrorLogger) << bm.Dir << " conversion time has grown from " << bm.ConversionTime.count() << " ms to "
+                         << conversionTime.count() << " ms, check bus wiring";
+    }
+    if (bm.ConversionTimeSamples == 0) {
+        bm.ConversionTime = conversionTime;
+    } else {
+        bm.ConversionTime = duration_cast<milliseconds>(bm.ConversionTime * (1 - CONVERSION_TIME_SMOOTHING) +
+                                                        conversionTime * CONVERSION_TIME_SMOOTHING);
+    }
+    ++bm.ConversionTimeSamples;
+}
+
+bool TSysfsOneWireManager::IsCancelled() const
+{
+    return CancellationToken && CancellationToken->IsCancelled();
+}
+
+milliseconds TSysfsOneWireManager::GetBusConversionTime(const std::string& busDir) const
+{
+    for (const auto& bm: BusMasters) {
+        if (bm.Dir == busDir) {
+            return bm.ConversionTime;
+        }
     }
-    std::sort(res.begin(), res.end(), [](const auto& v1, const auto& v2) { return v1->GetId() < v2->GetId(); });
-    return res;
+    return milliseconds::zero();
+}
+
+bool TOneWireDeviceFilter::MatchBusMaster(const std::string& name) const
+{
+    return MatchAny(BusMasters, name);
 }
 
-TOneWireReadErrorException::TOneWireReadErrorException(const std::string& message, const std::string& deviceFileName)
-    : std::runtime_error(message + " (" + deviceFileName + ")")
-{}
\ No newline at end of file
+bool TOneWireDeviceFilter::MatchSensorId(const std::string& id) const
+{
+    return MatchAny(SensorIds, id);
+}
+
+TOneWireReadErrorException::TOneWireReadErrorException(TErrorKind kind, const std::string& deviceFileName)
+    : std::runtime_error(GetDescription(kind)),
+      Kind(kind),
+      DeviceFileName(deviceFileName)
+{}
+
+TOneWireReadErrorException::TErrorKind TOneWireReadErrorException::GetKind() const
+{
+    return Kind;
+}
+
+const char* TOneWireReadErrorException::GetDescription(TErrorKind kind)
+{
+    switch (kind) {
+        case OpenError:
+            return "Can't open file";
+        case ReadError:
+            return "Can't read temperature";
+        case MeasurementError:
+            return "Measurement error";
+        case ThermometerError:
+            return "Thermometer error";
+        case CrcError:
+            return "Bad CRC";
+    }
+    return "Unknown error";
+}
+
+const char* TOneWireReadErrorException::what() const noexcept
+{
+    try {
+        if (Message.empty()) {
+            Message = std::string(GetDescription(Kind)) + " (" + DeviceFileName + ")";
+        }
+        return Message.c_str();
+    } catch (...) {
+        return GetDescription(Kind);
+    }
+}
\ No newline at end of file
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <wblib/log.h>
 
+#include "cancellation_token.h"
+#include "onewire_family.h"
+#include "sysfs_backend.h"
+#include "window_statistics.h"
+
 /**
  * @brief 1-Wire thermometer class
  *
@@ -28,8 +36,12 @@ public:
      * @param id unique identifier code of the thermometer, usually in form 28-00000a013d97
      * @param dir directory holding thermometer's folder in sysfs, usually /sys/bus/w1/devices/w1_bus_masterX
      * @param bulkRead true - use 'temperature' sysfs entry, false - use 'w1_slave' sysfs entry
+     * @param backend sysfs access implementation, nullptr - plain system calls
      */
-    TSysfsOneWireThermometer(const std::string& id, const std::string& dir, bool bulkRead = false);
+    TSysfsOneWireThermometer(const std::string& id,
+                             const std::string& dir,
+                             bool bulkRead = false,
+                             PSysfsBackend backend = nullptr);
 
     /**
      * @brief Get the Id object
@@ -38,6 +50,47 @@ public:
      */
     const std::string& GetId() const;
 
+    /**
+     * @brief Get identifier code parsed by ParseRomCode, 0 if the code has wrong format
+     */
+    uint64_t GetRomCode() const;
+
+    /**
+     * @brief Get directory holding thermometer's folder in sysfs
+     *
+     * @return const std::string& bus master directory, usually /sys/bus/w1/devices/w1_bus_masterX
+     */
+    const std::string& GetBusDir() const;
+
+    /**
+     * @brief Get sysfs entry holding temperature
+     */
+    const std::string& GetDeviceFileName() const;
+
+    /**
+     * @brief Set content of sysfs entry read in advance. It is used instead of reading the entry by next
+     *        GetTemperature call.
+     *
+     * @param content entry content, it is swapped with internal read buffer to avoid copying
+     * @param readTime completion time of the read. It is the sample time of 'w1_slave' entry,
+     *                 as the thermometer converts temperature while the entry is read
+     */
+    void SetPrefetchedContent(std::string& content, std::chrono::steady_clock::time_point readTime);
+
+    /**
+     * @brief Set completion time of bulk conversion on thermometer's bus. It is the sample time of 'temperature' entry
+     */
+    void SetConversionCompleteTime(std::chrono::steady_clock::time_point time);
+
+    /**
+     * @brief Get conversion completion time of the value returned by last GetTemperature call.
+     *        For 'w1_slave' entry it is the time the entry was read,
+     *        for 'temperature' entry it is set by SetConversionCompleteTime.
+     *
+     * @return sample time, default constructed time_point if it is unknown
+     */
+    std::chrono::steady_clock::time_point GetSampleTime() const;
+
     /**
      * @brief Get temperature. Throws TOneWireReadErrorException if read value is
      * incorrect.
@@ -67,42 +120,431 @@ public:
      */
     bool FoundAgain(const std::string& dir);
 
+    /**
+     * @brief Select sysfs entry to read temperature from
+     *
+     * @param bulkRead true - use 'temperature' sysfs entry, false - use 'w1_slave' sysfs entry
+     */
+    void SetBulkRead(bool bulkRead);
+
+    /**
+     * @brief Get rolling window statistics of read values. Statistics is disabled by default.
+     */
+    TWindowStatistics& GetStatistics();
+
+    /**
+     * @brief Get priority of the thermometer, see TSysfsOneWireManager::SetPriorities
+     */
+    int GetPriority() const;
+
+    void SetPriority(int priority);
+
+    /**
+     * @brief Check if temperature is read from 'temperature' entry after bulk conversion
+     */
+    bool IsBulkRead() const;
+
 private:
     void SetDeviceFileName(const std::string& dir);
 
     std::string Id;
+    uint64_t RomCode;
+    std::string BusDir;
     std::string DeviceFileName;
     PresenceStatus Status;
     bool BulkRead;
+    PSysfsBackend Backend;
+    TWindowStatistics Statistics;
+    int Priority;
+
+    //! Content of sysfs entry, the buffer is reused between reads
+    mutable std::string ReadBuffer;
+    mutable bool Prefetched;
+    std::chrono::steady_clock::time_point PrefetchTime;
+    std::chrono::steady_clock::time_point ConversionCompleteTime;
+    mutable std::chrono::steady_clock::time_point SampleTime;
+
+    //! Last read value in thousandths of degrees, it is used to check suspicious 85 degrees values
+    mutable std::optional<int> LastValue;
+};
+
+/**
+ * @brief 1-Wire device other than thermometer, e.g. DS2438 or DS2408.
+ *        All channels of the device are updated at once from its sysfs attributes.
+ *
+ */
+class TSysfsOneWireDevice
+{
+public:
+    /**
+     * @brief Construct a new TSysfsOneWireDevice object
+     *
+     * @param id unique identifier code of the device, e.g. 26-000001b5c1e2
+     * @param dir directory holding device's folder in sysfs, usually /sys/bus/w1/devices/w1_bus_masterX
+     * @param family description of device's family, see FindOneWireFamily
+     */
+    TSysfsOneWireDevice(const std::string& id, const std::string& dir, const TOneWireFamily& family);
+
+    const std::string& GetId() const;
+
+    /**
+     * @brief Get identifier code parsed by ParseRomCode, 0 if the code has wrong format
+     */
+    uint64_t GetRomCode() const;
+
+    /**
+     * @brief Get directory holding device's folder in sysfs
+     */
+    const std::string& GetBusDir() const;
+
+    const TOneWireFamily& GetFamily() const;
+
+    /**
+     * @brief Get full paths of sysfs attributes in order of TOneWireFamily::Attributes
+     */
+    const std::vector<std::string>& GetAttributePaths() const;
+
+    /**
+     * @brief Update channel values from read attributes
+     *
+     * @param attributes read attributes in order of GetAttributePaths
+     */
+    void SetValues(const TSysfsReadRequest* attributes);
+
+    /**
+     * @brief Get channel values in order of TOneWireFamily::Channels, std::nullopt - the channel can't be read
+     */
+    const std::vector<std::optional<double>>& GetValues() const;
+
+    TSysfsOneWireThermometer::PresenceStatus GetStatus() const;
+
+    /**
+     * @brief Mark device as disconnected. It can be deleted during next search cycle.
+     */
+    void MarkAsDisconnected();
+
+    /**
+     * @brief The device is found again during search cycle, see TSysfsOneWireThermometer::FoundAgain
+     *
+     * @return true - the device was located on the same bus
+     * @return false - device's bus is changed
+     */
+    bool FoundAgain(const std::string& dir);
+
+private:
+    void SetBusDir(const std::string& dir);
+
+    std::string Id;
+    uint64_t RomCode;
+    std::string BusDir;
+    const TOneWireFamily& Family;
+    TSysfsOneWireThermometer::PresenceStatus Status;
+    std::vector<std::string> AttributePaths;
+    std::vector<std::optional<double>> Values;
 };
 
 /**
- * @brief The class performs 1-Wire thermometers discovery and holds a list of known devices
+ * @brief Selection of bus masters and thermometers handled by TSysfsOneWireManager.
+ *        Patterns are shell wildcards as in fnmatch, e.g. w1_bus_master[12] or 28-0000*
+ *
+ */
+struct TOneWireDeviceFilter
+{
+    //! Patterns of bus master names, empty - all bus masters
+    std::vector<std::string> BusMasters;
+
+    //! Patterns of devices identifier codes, empty - all devices
+    std::vector<std::string> SensorIds;
+
+    bool MatchBusMaster(const std::string& name) const;
+    bool MatchSensorId(const std::string& id) const;
+};
+
+/**
+ * @brief The class performs 1-Wire devices discovery and holds a list of known devices.
+ *        Families of supported devices are described in onewire_family.h
  *
  */
 class TSysfsOneWireManager
 {
 public:
+    enum TBusPowerMode
+    {
+        UnknownPower,  // sensors don't report power mode
+        ExternalPower, // all sensors on the bus are externally powered
+        ParasitePower  // at least one sensor on the bus is parasite powered
+    };
+
     /**
      * @brief Construct a new TSysfsOneWireManager object
      *
      * @param devicesDir directory holding 1-Wire bus master files in sysfs, usually /sys/bus/w1/devices/
+     * @param cancellationToken token to interrupt waiting for conversion completion and batch reading, can be nullptr
+     * @param backend sysfs access implementation, nullptr - plain system calls
+     */
+    TSysfsOneWireManager(const std::string& devicesDir,
+                         WBMQTT::TLogger& debugLogger,
+                         WBMQTT::TLogger& errorLogger,
+                         const TCancellationToken* cancellationToken = nullptr,
+                         PSysfsBackend backend = nullptr);
+
+    /**
+     * @brief Destroy the TSysfsOneWireManager object and restore kernel search settings changed by SetExplicitSearch
      */
-    TSysfsOneWireManager(const std::string& devicesDir, WBMQTT::TLogger& debugLogger, WBMQTT::TLogger& errorLogger);
+    ~TSysfsOneWireManager();
 
     /**
      * @brief Perform devices discovery and starts bulk reading if possible.
      *
-     * @return array of available thermometers, thermometers disconnected since last call have Deleted status
+     * @return array of available thermometers, thermometers disconnected since last call have Deleted status.
+     *         The array is valid until next RescanBusAndRead or ReadBuses call.
+     */
+    const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& RescanBusAndRead();
+
+    /**
+     * @brief Perform devices discovery and start conversions without waiting for them, the first step of
+     *        RescanBusAndRead. It is completed by CheckConversions calls until they return true and CompleteRead call,
+     *        so the caller can do other work while thermometers convert.
      */
-    std::vector<std::shared_ptr<TSysfsOneWireThermometer>> RescanBusAndRead();
+    void StartRescan();
+
+    /**
+     * @brief Start conversions on selected buses without waiting for them, the first step of ReadBuses.
+     *        It is completed by CheckConversions and CompleteRead calls as StartRescan is.
+     */
+    void StartReadBuses(const std::unordered_set<std::string>& busDirs);
+
+    /**
+     * @brief Check status of conversions with reached check time without waiting.
+     *        Conversions not completed until the deadline are finished as failed.
+     *
+     * @param nextCheck time of next check if some conversions are not completed
+     * @return true - all conversions are finished, CompleteRead can be called
+     */
+    bool CheckConversions(std::chrono::steady_clock::time_point& nextCheck);
+
+    /**
+     * @brief Read values of conversions started by StartRescan or StartReadBuses
+     *
+     * @return array of thermometers as RescanBusAndRead or ReadBuses returns.
+     *         The array is valid until next StartRescan or StartReadBuses call.
+     */
+    const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& CompleteRead();
+
+    /**
+     * @brief Get devices other than thermometers with values read during last RescanBusAndRead call.
+     *        Attributes of all devices are read in one ISysfsBackend::ReadFiles batch.
+     *
+     * @return array of devices sorted by identifier code, devices disconnected since last call have Disconnected
+     *         status. The array is valid until next RescanBusAndRead call.
+     */
+    const std::vector<std::shared_ptr<TSysfsOneWireDevice>>& GetDevices() const;
+
+    /**
+     * @brief Restrict discovery to selected bus masters and thermometers. All devices are handled by default.
+     *        The filter is applied during next RescanBusAndRead call.
+     */
+    void SetFilter(const TOneWireDeviceFilter& filter);
+
+    /**
+     * @brief Control kernel background search of devices on bus masters.
+     *        If enabled, kernel search is stopped on every bus master found during RescanBusAndRead call,
+     *        so it doesn't interfere with conversions. Searches are started only by TriggerSearch calls.
+     *        If disabled, original kernel settings are restored. Kernel search is used by default.
+     */
+    void SetExplicitSearch(bool explicitSearch);
+
+    /**
+     * @brief Start single kernel search on bus masters found during last RescanBusAndRead call.
+     *        Does nothing if explicit search is disabled. Found devices are reported by next RescanBusAndRead call.
+     */
+    void TriggerSearch();
+
+    /**
+     * @brief Read thermometers in one batch after conversion with ISysfsBackend::ReadFiles.
+     *        Disabled by default, thermometers are read by TSysfsOneWireThermometer::GetTemperature calls.
+     */
+    void SetBatchRead(bool batchRead);
+
+    /**
+     * @brief Allow bulk conversion on buses supporting it. Enabled by default.
+     *        If disabled, every thermometer performs its own conversion while reading 'w1_slave' entry.
+     *        The setting is applied during next RescanBusAndRead call.
+     */
+    void SetBulkConversion(bool bulkConversion);
+
+    /**
+     * @brief Enable synchronized conversion. Conversions on all buses read by RescanBusAndRead or ReadBuses call
+     *        are triggered together after devices discovery: bulk conversions are triggered one after another,
+     *        then, if batch reading is enabled, 'w1_slave' entries of thermometers on other buses are read
+     *        without waiting for bulk conversions. Every ISysfsBackend::ReadFiles batch holds one thermometer
+     *        of every bus, bulk conversions are checked between the batches. Without batch reading 'w1_slave'
+     *        entries are read after bulk conversions as usual, so StartRescan and StartReadBuses don't block
+     *        on sequential reads. Disabled by default.
+     */
+    void SetSynchronizedConversion(bool synchronizedConversion);
+
+    /**
+     * @brief Get time between the first and the last conversion trigger of last RescanBusAndRead or ReadBuses call
+     *        in synchronized conversion mode. 'w1_slave' batch is considered triggered when it is submitted.
+     */
+    std::chrono::microseconds GetTriggerSkew() const;
+
+    /**
+     * @brief Set priorities of thermometers. Thermometers returned by RescanBusAndRead and ReadBuses are ordered
+     *        by descending priority and then by identifier code, so thermometers with higher priority are read
+     *        and published first. Priority of thermometers not listed is 0.
+     *
+     * @param priorities priorities of thermometers, key is thermometer's identifier code
+     */
+    void SetPriorities(const std::unordered_map<std::string, int>& priorities);
+
+    /**
+     * @brief Start conversion on selected buses found during last RescanBusAndRead call without devices discovery.
+     *
+     * @param busDirs directories of bus masters to read, as returned by TSysfsOneWireThermometer::GetBusDir
+     * @return array of known thermometers on selected buses.
+     *         The array is valid until next RescanBusAndRead or ReadBuses call.
+     */
+    const std::vector<std::shared_ptr<TSysfsOneWireThermometer>>& ReadBuses(
+        const std::unordered_set<std::string>& busDirs);
+
+    /**
+     * @brief Find a thermometer by identifier code
+     *
+     * @return known thermometer or nullptr if it was not found during previous RescanBusAndRead calls
+     */
+    std::shared_ptr<TSysfsOneWireThermometer> FindDevice(const std::string& id) const;
+
+    /**
+     * @brief Get power mode of a bus detected during last RescanBusAndRead call
+     *
+     * @param busDir directory of bus master, as returned by TSysfsOneWireThermometer::GetBusDir
+     */
+    TBusPowerMode GetBusPowerMode(const std::string& busDir) const;
+
+    /**
+     * @brief Get learned bulk conversion time of a bus
+     *
+     * @param busDir directory of bus master, as returned by TSysfsOneWireThermometer::GetBusDir
+     * @return std::chrono::milliseconds moving estimate of conversion time, 0 if it is not known yet
+     */
+    std::chrono::milliseconds GetBusConversionTime(const std::string& busDir) const;
 
 private:
+    struct TBusMaster
+    {
+        std::string Name;
+        std::string Dir;
+
+        //! Paths of bus master's sysfs entries, they are built once to avoid allocations during polling
+        std::string BulkReadPath;
+        std::string SlavesPath;
+        std::string SearchPath;
+
+        //! The bus master is found during current RescanBusAndRead call
+        bool Found = false;
+
+        bool SupportsBulkRead = false;
+
+        //! Bulk conversion is used on the bus, it is disabled on buses with parasite powered sensors
+        bool BulkRead = false;
+
+        TBusPowerMode PowerMode = UnknownPower;
+
+        //! Identifier codes of thermometers on the bus, power mode is detected again if they change
+        std::vector<std::string> SensorIds;
+
+        std::chrono::steady_clock::time_point ConversionStart;
+
+        //! Time the bus reported conversion completion, it is detected with bus status polling interval accuracy
+        std::chrono::steady_clock::time_point ConversionComplete;
+
+        //! Moving estimate of bulk conversion time
+        std::chrono::milliseconds ConversionTime = std::chrono::milliseconds::zero();
+        size_t ConversionTimeSamples = 0;
+    };
+
+    enum TPrefetchEntries
+    {
+        AllEntries,
+        BulkReadEntries // 'temperature' entries of thermometers on buses with bulk conversion
+    };
+
+    struct TConversion
+    {
+        TBusMaster* BusMaster;
+        std::chrono::steady_clock::time_point NextCheck;
+    };
+
+    void ListSensors(const TBusMaster& bm);
+    void StopKernelSearch(const TBusMaster& bm);
+    void RestoreKernelSearch();
+    void DetectPowerMode(TBusMaster& bm);
+    void StartBulkConversion(TBusMaster& bm);
+    void WaitForConversion();
+
+    /**
+     * @brief Add a sample to the moving estimate of conversion time and log an error if the bus looks faulty
+     *
+     * @param completed false - the conversion was not completed until the wait deadline
+     */
+    void UpdateConversionTime(TBusMaster& bm, std::chrono::milliseconds conversionTime, bool completed);
+
+    int GetPriority(const std::string& id) const;
+    bool IsCancelled() const;
+    void SetConversionCompleteTimes();
+    void StartConversions(const std::unordered_set<std::string>* busDirs);
+    void PrefetchTemperatures(TPrefetchEntries entries);
+    /**
+     * @brief Read 'w1_slave' entries in batches by rounds
+     *
+     * @param triggerStart start of conversion triggers, TriggerSkew is measured up to submission of the first round.
+     *                     nullptr - TriggerSkew is not changed
+     */
+    void ReadDirectEntries(const std::chrono::steady_clock::time_point* triggerStart);
+    void ReadDevices();
+
     std::string DevicesDir;
     WBMQTT::TLogger& DebugLogger;
     WBMQTT::TLogger& ErrorLogger;
+    const TCancellationToken* CancellationToken;
+    PSysfsBackend Backend;
+    TOneWireDeviceFilter Filter;
+    bool ExplicitSearch;
+    bool BatchRead;
+    bool BulkConversion;
+    bool SynchronizedConversion;
+    std::chrono::microseconds TriggerSkew;
+
+    //! Conversions are started by StartRescan, so other devices are read by CompleteRead too
+    bool Rescanning;
+    std::vector<TSysfsReadRequest> BatchReadRequests;
+    std::unordered_map<std::string, int> Priorities;
+
+    //! Original w1_master_search values of bus masters with stopped kernel search. Key is bus master directory
+    std::unordered_map<std::string, std::string> KernelSearchSettings;
 
-    std::unordered_map<std::string, std::shared_ptr<TSysfsOneWireThermometer>> Devices;
+    //! Known devices sorted by ROM code and identifier code. Lookups are binary searches over integer keys
+    std::vector<std::shared_ptr<TSysfsOneWireThermometer>> Devices;
+    std::vector<std::shared_ptr<TSysfsOneWireDevice>> GenericDevices;
+    std::vector<TBusMaster> BusMasters;
+
+    // Buffers reused between polling cycles, so steady state polling doesn't allocate memory
+    std::vector<std::string> BusMasterNames;
+    std::vector<std::string> DirEntries;
+    std::vector<std::string> ScannedSensorIds;
+    std::vector<std::string> ScannedDeviceIds;
+    std::string ReadBuffer;
+    std::vector<TConversion> Conversions;
+    std::chrono::steady_clock::time_point ConversionDeadline;
+    std::vector<std::shared_ptr<TSysfsOneWireThermometer>> ScannedDevices;
+    std::vector<std::shared_ptr<TSysfsOneWireDevice>> ScannedGenericDevices;
+    std::vector<TSysfsReadRequest> DeviceReadRequests;
+
+    //! Batches of w1_slave entries, one per round, and round numbers of ScannedDevices
+    std::vector<std::vector<TSysfsReadRequest>> DirectReadRequests;
+    std::vector<size_t> DirectReadRounds;
 };
 
 /**
@@ -112,5 +554,31 @@ private:
 class TOneWireReadErrorException: public std::runtime_error
 {
 public:
-    TOneWireReadErrorException(const std::string& message, const std::string& deviceFileName);
+    enum TErrorKind
+    {
+        OpenError,        // can't open sysfs entry
+        ReadError,        // sysfs entry doesn't contain temperature value
+        MeasurementError, // sensor power on value is read (no conversion)
+        ThermometerError, // max possible temperature is read
+        CrcError          // CRC check failed
+    };
+
+    TOneWireReadErrorException(TErrorKind kind, const std::string& deviceFileName);
+
+    TErrorKind GetKind() const;
+
+    /**
+     * @brief Get short description of an error kind, e.g. "Bad CRC"
+     */
+    static const char* GetDescription(TErrorKind kind);
+
+    /**
+     * @brief Get full error message. It is formatted on first call.
+     */
+    const char* what() const noexcept override;
+
+private:
+    TErrorKind Kind;
+    std::string DeviceFileName;
+    mutable std::string Message;
 };
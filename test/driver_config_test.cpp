@@ -0,0 +1,115 @@
+#include "driver_config.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+
+using namespace std;
+using namespace std::chrono;
+
+class TDriverConfigTest: public ::testing::Test
+{
+protected:
+    string ConfigFile;
+
+    void SetUp() override
+    {
+        ConfigFile = ::testing::TempDir() + "wb-mqtt-w1-test-config.json";
+    }
+
+    void TearDown() override
+    {
+        remove(ConfigFile.c_str());
+    }
+
+    void WriteConfig(const string& content)
+    {
+        ofstream f(ConfigFile, ofstream::trunc);
+        f << content;
+    }
+};
+
+TEST_F(TDriverConfigTest, load)
+{
+    WriteConfig(R"({
+        "poll_interval_ms": 5000,
+        "aggregation_window": 10,
+        "fast_poll_interval_ms": 1000,
+        "read_commands": true,
+        "error_log_period_s": 30,
+        "explicit_search": true,
+        "batch_read": true,
+        "sample_times": true,
+        "synchronized_conversion": true,
+        "sensors": ["28-0000*", "10-*"],
+        "thresholds": [
+            {"id": "28-00000a013d97", "high": 60, "hysteresis": 0.5},
+            {"id": "28-00000a013000", "low": -10}
+        ],
+        "priorities": {"28-00000a013d97": 10, "28-00000a013000": -1}
+    })");
+    TOneWireDriverSettings settings;
+    settings.Filter.BusMasters = {"w1_bus_master1"};
+    settings.Thresholds["28-00000a0131ff"] = TThresholds();
+    settings.Priorities["28-00000a0131ff"] = 5;
+    LoadDriverConfig(ConfigFile, settings);
+
+    EXPECT_EQ(settings.PollInterval, milliseconds(5000));
+    EXPECT_EQ(settings.AggregationWindow, 10);
+    EXPECT_EQ(settings.FastPollInterval, milliseconds(1000));
+    EXPECT_TRUE(settings.ReadCommands);
+    EXPECT_EQ(settings.ErrorLogPeriod, seconds(30));
+    EXPECT_TRUE(settings.ExplicitSearch);
+    EXPECT_TRUE(settings.BatchRead);
+    EXPECT_TRUE(settings.SampleTimes);
+    EXPECT_TRUE(settings.SynchronizedConversion);
+    EXPECT_EQ(settings.Filter.SensorIds, vector<string>({"28-0000*", "10-*"}));
+    EXPECT_EQ(settings.Filter.BusMasters, vector<string>({"w1_bus_master1"}));
+
+    // Thresholds are replaced
+    ASSERT_EQ(settings.Thresholds.size(), 2);
+    const auto& t1 = settings.Thresholds["28-00000a013d97"];
+    EXPECT_FALSE(t1.Low);
+    EXPECT_EQ(t1.High, 60);
+    EXPECT_EQ(t1.Hysteresis, 0.5);
+    const auto& t2 = settings.Thresholds["28-00000a013000"];
+    EXPECT_EQ(t2.Low, -10);
+    EXPECT_FALSE(t2.High);
+
+    // Priorities are replaced
+    EXPECT_EQ(settings.Priorities, (unordered_map<string, int>{{"28-00000a013d97", 10}, {"28-00000a013000", -1}}));
+}
+
+TEST_F(TDriverConfigTest, absent_parameters_are_kept)
+{
+    WriteConfig(R"({"aggregation_window": 5})");
+    TOneWireDriverSettings settings;
+    settings.ReadCommands = true;
+    settings.ErrorLogPeriod = seconds(10);
+    settings.Thresholds["28-00000a013d97"] = TThresholds();
+    LoadDriverConfig(ConfigFile, settings);
+    EXPECT_EQ(settings.AggregationWindow, 5);
+    EXPECT_TRUE(settings.ReadCommands);
+    EXPECT_EQ(settings.ErrorLogPeriod, seconds(10));
+    EXPECT_EQ(settings.Thresholds.size(), 1);
+    EXPECT_EQ(settings.PollInterval, milliseconds::zero());
+}
+
+TEST_F(TDriverConfigTest, errors)
+{
+    TOneWireDriverSettings settings;
+    EXPECT_THROW(LoadDriverConfig(ConfigFile + ".absent", settings), runtime_error);
+
+    for (const auto& config: {R"({"poll_interval_ms": 5000)",
+                              R"([])",
+                              R"({"poll_interval_ms": -1})",
+                              R"({"read_commands": "yes"})",
+                              R"({"sensors": [1]})",
+                              R"({"thresholds": [{"high": 60}]})",
+                              R"({"thresholds": [{"id": "28-00000a013d97", "high": "60"}]})",
+                              R"({"priorities": [10]})",
+                              R"({"priorities": {"28-00000a013d97": 1.5}})"})
+    {
+        WriteConfig(config);
+        EXPECT_THROW(LoadDriverConfig(ConfigFile, settings), runtime_error) << config;
+    }
+}
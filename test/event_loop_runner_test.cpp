@@ -0,0 +1,146 @@
+#include "cancellation_token.h"
+#include "event_loop_runner.h"
+#include <gtest/gtest.h>
+#include <wblib/testing/testlog.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace WBMQTT;
+using namespace WBMQTT::Testing;
+
+namespace
+{
+    class TCountingWorker: public IPeriodicalWorker
+    {
+    public:
+        TCountingWorker(mutex& m, condition_variable& cv): Mutex(m), CV(cv)
+        {}
+
+        void RunIteration() override
+        {
+            {
+                lock_guard<mutex> lg(Mutex);
+                ++Counter;
+                ThreadId = this_thread::get_id();
+            }
+            CV.notify_all();
+        }
+
+        void SetWakeUpHandler(function<void()> wakeUp) override
+        {
+            lock_guard<mutex> lg(Mutex);
+            WakeUp = wakeUp;
+        }
+
+        function<void()> WakeUp;
+        int Counter = 0;
+        thread::id ThreadId;
+
+    private:
+        mutex& Mutex;
+        condition_variable& CV;
+    };
+
+    class TBlockingWorker: public TCountingWorker
+    {
+    public:
+        using TCountingWorker::TCountingWorker;
+
+        void RunIteration() override
+        {
+            TCountingWorker::RunIteration();
+            StopToken.WaitUntil(steady_clock::now() + seconds(10));
+        }
+
+        void Cancel() override
+        {
+            StopToken.Cancel();
+        }
+
+    private:
+        TCancellationToken StopToken;
+    };
+}
+
+class TEventLoopRunnerTest: public TLoggedFixture
+{
+protected:
+    mutex Mutex;
+    condition_variable CV;
+
+    bool WaitForCounter(const TCountingWorker& worker, int value)
+    {
+        unique_lock<mutex> lk(Mutex);
+        return CV.wait_for(lk, seconds(5), [&] { return worker.Counter >= value; });
+    }
+
+    vector<TEventLoopRunner::TTask> MakeTasks(IPeriodicalWorker* worker, milliseconds pollInterval)
+    {
+        vector<TEventLoopRunner::TTask> tasks;
+        tasks.push_back({unique_ptr<IPeriodicalWorker>(worker), pollInterval});
+        return tasks;
+    }
+};
+
+TEST_F(TEventLoopRunnerTest, wake_up)
+{
+    auto worker = new TCountingWorker(Mutex, CV);
+    TEventLoopRunner runner(MakeTasks(worker, hours(1)), "test", Debug);
+    ASSERT_TRUE(WaitForCounter(*worker, 1));
+    function<void()> wakeUp;
+    {
+        lock_guard<mutex> lg(Mutex);
+        wakeUp = worker->WakeUp;
+    }
+    ASSERT_TRUE(!!wakeUp);
+    wakeUp();
+    EXPECT_TRUE(WaitForCounter(*worker, 2));
+}
+
+TEST_F(TEventLoopRunnerTest, workers_share_thread)
+{
+    auto fastWorker = new TCountingWorker(Mutex, CV);
+    auto slowWorker = new TCountingWorker(Mutex, CV);
+    vector<TEventLoopRunner::TTask> tasks;
+    tasks.push_back({unique_ptr<IPeriodicalWorker>(fastWorker), milliseconds(20)});
+    tasks.push_back({unique_ptr<IPeriodicalWorker>(slowWorker), hours(1)});
+    TEventLoopRunner runner(move(tasks), "test", Debug);
+
+    ASSERT_TRUE(WaitForCounter(*fastWorker, 5));
+    lock_guard<mutex> lg(Mutex);
+    EXPECT_EQ(slowWorker->Counter, 1);
+    EXPECT_EQ(fastWorker->ThreadId, slowWorker->ThreadId);
+    EXPECT_NE(fastWorker->ThreadId, this_thread::get_id());
+}
+
+TEST_F(TEventLoopRunnerTest, no_extra_wakeups)
+{
+    auto worker = new TCountingWorker(Mutex, CV);
+    auto start = steady_clock::now();
+    {
+        TEventLoopRunner runner(MakeTasks(worker, milliseconds(100)), "test", Debug);
+        this_thread::sleep_for(milliseconds(550));
+    }
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+    lock_guard<mutex> lg(Mutex);
+    EXPECT_LE(worker->Counter, elapsed.count() / 100 + 1);
+    EXPECT_GE(worker->Counter, 4);
+}
+
+TEST_F(TEventLoopRunnerTest, shutdown_latency)
+{
+    auto worker = new TBlockingWorker(Mutex, CV);
+    auto runner = make_unique<TEventLoopRunner>(MakeTasks(worker, hours(1)), "test", Debug);
+    ASSERT_TRUE(WaitForCounter(*worker, 1));
+
+    auto start = steady_clock::now();
+    runner.reset();
+    auto shutdownTime = duration_cast<milliseconds>(steady_clock::now() - start);
+    EXPECT_LT(shutdownTime.count(), 500);
+}
+
+TEST_F(TEventLoopRunnerTest, wrong_interval)
+{
+    EXPECT_THROW(TEventLoopRunner(MakeTasks(new TCountingWorker(Mutex, CV), milliseconds(0)), "test", Debug),
+                 invalid_argument);
+}
@@ -0,0 +1,45 @@
+#include "latency_stats.h"
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+TEST(TLatencyStatisticsTest, empty)
+{
+    TLatencyStatistics statistics;
+    EXPECT_EQ(statistics.GetCount(), 0);
+    EXPECT_EQ(statistics.GetPercentile(50).count(), 0);
+    EXPECT_EQ(statistics.GetMean().count(), 0);
+    EXPECT_EQ(statistics.GetMax().count(), 0);
+}
+
+TEST(TLatencyStatisticsTest, percentiles)
+{
+    TLatencyStatistics statistics;
+    // Samples are added in reverse order to check sorting
+    for (int i = 100; i > 0; --i) {
+        statistics.AddSample(microseconds(i));
+    }
+    EXPECT_EQ(statistics.GetCount(), 100);
+    EXPECT_EQ(statistics.GetPercentile(0).count(), 1);
+    EXPECT_EQ(statistics.GetPercentile(50).count(), 50);
+    EXPECT_EQ(statistics.GetPercentile(90).count(), 90);
+    EXPECT_EQ(statistics.GetPercentile(99).count(), 99);
+    EXPECT_EQ(statistics.GetPercentile(99.5).count(), 100);
+    EXPECT_EQ(statistics.GetPercentile(100).count(), 100);
+    EXPECT_EQ(statistics.GetMax().count(), 100);
+    EXPECT_EQ(statistics.GetMean().count(), 50);
+
+    // New sample after percentile request
+    statistics.AddSample(microseconds(1000));
+    EXPECT_EQ(statistics.GetPercentile(100).count(), 1000);
+
+    EXPECT_THROW(statistics.GetPercentile(101), std::invalid_argument);
+}
+
+TEST(TLatencyStatisticsTest, single_sample)
+{
+    TLatencyStatistics statistics;
+    statistics.AddSample(milliseconds(750));
+    EXPECT_EQ(statistics.GetPercentile(1), milliseconds(750));
+    EXPECT_EQ(statistics.GetPercentile(99), milliseconds(750));
+}
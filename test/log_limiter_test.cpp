@@ -0,0 +1,64 @@
+#include "log_limiter.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+    struct TSummary
+    {
+        std::string Source;
+        int Kind;
+        size_t Count;
+    };
+
+    std::vector<TSummary> Flush(TLogRateLimiter& limiter, steady_clock::time_point now)
+    {
+        std::vector<TSummary> res;
+        limiter.Flush([&](const auto& source, int kind, size_t count) { res.push_back({source, kind, count}); },
+                      now);
+        return res;
+    }
+}
+
+TEST(TLogRateLimiterTest, suppression_and_summary)
+{
+    TLogRateLimiter limiter(seconds(60));
+    auto start = steady_clock::now();
+
+    EXPECT_TRUE(limiter.Report("28-1", 1, start));
+    EXPECT_FALSE(limiter.Report("28-1", 1, start + seconds(1)));
+    EXPECT_FALSE(limiter.Report("28-1", 1, start + seconds(2)));
+
+    // Other kind and other source are not suppressed
+    EXPECT_TRUE(limiter.Report("28-1", 2, start + seconds(3)));
+    EXPECT_TRUE(limiter.Report("28-2", 1, start + seconds(3)));
+
+    EXPECT_TRUE(Flush(limiter, start + seconds(30)).empty());
+
+    auto summary = Flush(limiter, start + seconds(61));
+    ASSERT_EQ(summary.size(), 1);
+    EXPECT_EQ(summary[0].Source, "28-1");
+    EXPECT_EQ(summary[0].Kind, 1);
+    EXPECT_EQ(summary[0].Count, 2);
+
+    // Errors continue, they are reported by summary only
+    EXPECT_FALSE(limiter.Report("28-1", 1, start + seconds(62)));
+    summary = Flush(limiter, start + seconds(122));
+    ASSERT_EQ(summary.size(), 1);
+    EXPECT_EQ(summary[0].Count, 1);
+
+    // No errors during the period, next error is logged at once
+    EXPECT_TRUE(Flush(limiter, start + seconds(183)).empty());
+    EXPECT_TRUE(limiter.Report("28-1", 1, start + seconds(184)));
+}
+
+TEST(TLogRateLimiterTest, zero_period)
+{
+    TLogRateLimiter limiter(seconds(0));
+    auto now = steady_clock::now();
+    EXPECT_TRUE(limiter.Report("28-1", 1, now));
+    EXPECT_TRUE(limiter.Report("28-1", 1, now));
+    EXPECT_TRUE(Flush(limiter, now).empty());
+}
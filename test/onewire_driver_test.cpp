@@ -1,12 +1,18 @@
-
+#include "event_loop_runner.h"
 #include "onewire_driver.h"
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <map>
+#include <sstream>
 #include <stdio.h>
+#include <thread>
 #include <wblib/driver_args.h>
 #include <wblib/testing/fake_driver.h>
 #include <wblib/testing/fake_mqtt.h>
 #include <wblib/testing/testlog.h>
+#include <wblib/utils.h>
 
 using namespace std;
 using namespace WBMQTT;
@@ -14,6 +20,38 @@ using namespace WBMQTT::Testing;
 
 const string DeviceId("wb-w1");
 
+namespace
+{
+    class TCountingWorker: public IPeriodicalWorker
+    {
+    public:
+        void RunIteration() override
+        {
+            ++Counter;
+        }
+
+        atomic<int> Counter{0};
+    };
+
+    //! Reads w1_slave entries with a delay like a thermometer converting during the read
+    class TSlowDirectReadBackend: public TPlainSysfsBackend
+    {
+    public:
+        bool ReadFile(const string& path, string& content) override
+        {
+            if (StringHasSuffix(path, "/w1_slave")) {
+                this_thread::sleep_for(chrono::milliseconds(300));
+            }
+            return TPlainSysfsBackend::ReadFile(path, content);
+        }
+    };
+
+    int64_t GetUnixTimeMs()
+    {
+        return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+}
+
 class TOnewireDriverTest: public TLoggedFixture
 {
 protected:
@@ -31,7 +69,10 @@ protected:
         }
         test_sensor_dir += "fake_sensors/";
 
-        MqttBroker = NewFakeMqttBroker(*this);
+        // The driver writes bulk conversion triggers to the file
+        KeepFakeFile(test_sensor_dir + "2_buses/w1_bus_master2/therm_bulk_read");
+
+        MqttBroker = NewFakeMqttBroker(GetMqttLog());
         MqttClient = MqttBroker->MakeClient("onewire-driver-test");
         auto backend = NewDriverBackend(MqttClient);
         Driver = NewDriver(TDriverArgs{}
@@ -46,12 +87,125 @@ protected:
     void TearDown()
     {
         Driver->StopLoop();
+        for (const auto& file: ChangedFiles) {
+            ofstream(file.first, ofstream::trunc) << file.second;
+        }
         TLoggedFixture::TearDown();
     }
 
+    /**
+     * @brief Save content of a fake sysfs file to restore it after the test
+     */
+    void KeepFakeFile(const string& path)
+    {
+        if (!ChangedFiles.count(path)) {
+            stringstream original;
+            original << ifstream(path).rdbuf();
+            ChangedFiles[path] = original.str();
+        }
+    }
+
+    /**
+     * @brief Replace content of a fake sysfs file, the file is restored after the test
+     */
+    void WriteFakeFile(const string& path, const string& content)
+    {
+        KeepFakeFile(path);
+        ofstream(path, ofstream::trunc) << content;
+    }
+
+    /**
+     * @brief Write w1_slave of a fake thermometer, crcOk = false simulates a read error
+     */
+    void SetTemperature(const string& sensorDir, int milliCelsius, bool crcOk = true)
+    {
+        stringstream content;
+        content << "a5 01 4b 46 7f ff 0b 10 f7 : crc=f7 " << (crcOk ? "YES" : "NO") << endl
+                << "a5 01 4b 46 7f ff 0b 10 f7 t=" << milliCelsius << endl;
+        WriteFakeFile(sensorDir + "/w1_slave", content.str());
+    }
+
+    void SetBulkReadStatus(const string& busDir, const char* status)
+    {
+        WriteFakeFile(busDir + "/therm_bulk_read", status);
+    }
+
+    /**
+     * @brief Log of MQTT traffic. Tests of non-reproducible values override it to keep the traffic out of .dat file
+     */
+    virtual TLoggedFixture& GetMqttLog()
+    {
+        return *this;
+    }
+
+    /**
+     * @brief Run iterations until conversions are completed and the worker waits for next polling cycle
+     */
+    void CompleteIteration(TOneWireDriverWorker& worker)
+    {
+        const auto pollInterval = chrono::hours(1);
+        worker.RunIteration();
+        for (int i = 0; i < 100 && worker.GetNextIterationDelay(pollInterval) < chrono::minutes(59); ++i) {
+            this_thread::sleep_for(worker.GetNextIterationDelay(pollInterval));
+            worker.RunIteration();
+        }
+    }
+
+    //! Control of the driver's device, nullptr if it doesn't exist
+    PControl GetControl(const string& controlId)
+    {
+        return Driver->BeginTx()->GetDevice(DeviceId)->GetControl(controlId);
+    }
+
+    /**
+     * @brief Press a pushbutton of the driver's device and wait until the worker requests next iteration
+     */
+    void Press(TOneWireDriverWorker& worker, const string& controlId)
+    {
+        mutex m;
+        condition_variable cv;
+        bool wokenUp = false;
+        worker.SetWakeUpHandler([&] {
+            {
+                lock_guard<mutex> lg(m);
+                wokenUp = true;
+            }
+            cv.notify_all();
+        });
+        MqttBroker->Publish("test", {"/devices/" + DeviceId + "/controls/" + controlId + "/on", "1", 1, false});
+        unique_lock<mutex> lk(m);
+        EXPECT_TRUE(cv.wait_for(lk, chrono::seconds(5), [&] { return wokenUp; }));
+        lk.unlock();
+        worker.SetWakeUpHandler(nullptr);
+    }
+
     PFakeMqttBroker MqttBroker;
     PFakeMqttClient MqttClient;
     PDeviceDriver Driver;
+
+    //! Original content of fake sysfs files changed by the test, key is file path
+    map<string, string> ChangedFiles;
+};
+
+/**
+ * @brief Fixture for controls with timing values. MQTT traffic isn't logged,
+ *        tests check values of controls and emit reproducible results
+ */
+class TOnewireDriverTimingTest: public TOnewireDriverTest
+{
+protected:
+    class TQuietLog: public TLoggedFixture
+    {
+        void TestBody() override
+        {}
+    };
+
+    TLoggedFixture& GetMqttLog() override
+    {
+        return QuietLog;
+    }
+
+    TQuietLog QuietLog;
 };
 
 TEST_F(TOnewireDriverTest, create_and_read)
@@ -78,11 +232,250 @@ TEST_F(TOnewireDriverTest, move_and_read)
 
 TEST_F(TOnewireDriverTest, bulk_read)
 {
-    std::ofstream f;
-    f.open(test_sensor_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
-    f << "1";
-    f.close();
+    SetBulkReadStatus(test_sensor_dir + "2_buses/w1_bus_master2", "1");
     TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/");
     w1_driver.RunIteration();
     Emit() << "Clear()";
-}
\ No newline at end of file
+}
+TEST_F(TOnewireDriverTest, read_command_keeps_full_scan_schedule)
+{
+    TOneWireDriverSettings settings;
+    settings.ReadCommands = true;
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "1_sensor/", settings);
+    const auto pollInterval = chrono::milliseconds(1000);
+    w1_driver.RunIteration();
+    auto nextFullScan = chrono::steady_clock::now() + w1_driver.GetNextIterationDelay(pollInterval);
+
+    this_thread::sleep_for(chrono::milliseconds(300));
+    Emit() << "Read command";
+    Press(w1_driver, "28-00000a013d97_read");
+    w1_driver.RunIteration();
+
+    // The read doesn't postpone next full scan
+    auto delay = w1_driver.GetNextIterationDelay(pollInterval);
+    EXPECT_LT(delay, pollInterval - chrono::milliseconds(250));
+    EXPECT_LE(chrono::steady_clock::now() + delay, nextFullScan + chrono::milliseconds(50));
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTest, conversion_wait)
+{
+    const auto busDir = test_sensor_dir + "2_buses/w1_bus_master2";
+    SetBulkReadStatus(busDir, "0");
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/");
+
+    // The iteration returns right after conversion trigger and continues at conversion check time
+    auto start = chrono::steady_clock::now();
+    w1_driver.RunIteration();
+    EXPECT_LT(chrono::steady_clock::now() - start, chrono::milliseconds(50));
+    auto delay = w1_driver.GetNextIterationDelay(chrono::hours(1));
+    EXPECT_LE(delay, chrono::milliseconds(100));
+
+    Emit() << "Conversion is completed";
+    SetBulkReadStatus(busDir, "1");
+    this_thread::sleep_for(delay);
+    w1_driver.RunIteration();
+    EXPECT_GT(w1_driver.GetNextIterationDelay(chrono::hours(1)), chrono::minutes(59));
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTest, event_loop_conversion_wait)
+{
+    const auto busDir = test_sensor_dir + "2_buses/w1_bus_master2";
+    SetBulkReadStatus(busDir, "0");
+    auto counter = new TCountingWorker();
+    vector<TEventLoopRunner::TTask> tasks;
+    tasks.push_back(
+        {make_unique<TOneWireDriverWorker>(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/"),
+         chrono::hours(1)});
+    tasks.push_back({unique_ptr<IPeriodicalWorker>(counter), chrono::milliseconds(20)});
+    auto runner = make_unique<TEventLoopRunner>(move(tasks), "test", Debug);
+
+    // Another worker runs while the driver waits for conversion
+    this_thread::sleep_for(chrono::milliseconds(500));
+    EXPECT_GE(counter->Counter, 10);
+    SetBulkReadStatus(busDir, "1");
+    this_thread::sleep_for(chrono::milliseconds(300));
+    Emit() << "Clear()";
+    runner.reset();
+}
+
+TEST_F(TOnewireDriverTest, statistics)
+{
+    const auto sensorDir = test_sensor_dir + "1_sensor/w1_bus_master1/28-00000a013d97";
+    TOneWireDriverSettings settings;
+    settings.AggregationWindow = 2;
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "1_sensor/", settings);
+
+    // Statistics is published once per window
+    SetTemperature(sensorDir, 20000);
+    w1_driver.RunIteration();
+    Emit() << "Second cycle of the window";
+    SetTemperature(sensorDir, 22000);
+    w1_driver.RunIteration();
+
+    // Failed reads are not counted
+    Emit() << "Read error";
+    SetTemperature(sensorDir, 30000, false);
+    w1_driver.RunIteration();
+    Emit() << "Second cycle of the window";
+    SetTemperature(sensorDir, 24000);
+    w1_driver.RunIteration();
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTest, alarm_fast_polling)
+{
+    const auto alarmedSensorDir = test_sensor_dir + "2_buses/w1_bus_master1/28-00000a013d97";
+    TOneWireDriverSettings settings;
+    settings.Thresholds["28-00000a013d97"] = TThresholds{std::nullopt, 30, 1};
+    settings.FastPollInterval = chrono::milliseconds(100);
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/", settings);
+    const auto pollInterval = chrono::hours(1);
+
+    SetTemperature(alarmedSensorDir, 31000);
+    w1_driver.RunIteration();
+    auto delay = w1_driver.GetNextIterationDelay(pollInterval);
+    EXPECT_LE(delay, settings.FastPollInterval);
+
+    // Only the bus with alarmed thermometer is read, the alarm is kept within hysteresis
+    Emit() << "Fast polling";
+    SetTemperature(alarmedSensorDir, 29500);
+    this_thread::sleep_for(delay);
+    w1_driver.RunIteration();
+    delay = w1_driver.GetNextIterationDelay(pollInterval);
+    EXPECT_LE(delay, settings.FastPollInterval);
+
+    Emit() << "Back within limits";
+    SetTemperature(alarmedSensorDir, 28500);
+    this_thread::sleep_for(delay);
+    w1_driver.RunIteration();
+    EXPECT_GT(w1_driver.GetNextIterationDelay(pollInterval), chrono::minutes(59));
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTest, device_channels)
+{
+    const auto busDir = test_sensor_dir + "mixed_bus/w1_bus_master1/";
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "mixed_bus/");
+
+    // Every channel of a supported device gets its control, a channel read error is set as the control error.
+    // Devices of unknown families are ignored
+    w1_driver.RunIteration();
+
+    Emit() << "Disconnect DS2408";
+    rename((busDir + "29-00000012ab01").c_str(), (busDir + "tmp-29-00000012ab01").c_str());
+    w1_driver.RunIteration();
+    rename((busDir + "tmp-29-00000012ab01").c_str(), (busDir + "29-00000012ab01").c_str());
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTest, reload_config)
+{
+    TOneWireDriverWorker* worker = nullptr;
+    TOneWireDriverSettings newSettings;
+    newSettings.Thresholds["28-00000a013d97"] = TThresholds{std::nullopt, 20, 0};
+    newSettings.AggregationWindow = 2;
+
+    TOneWireDriverSettings settings;
+    settings.ReadCommands = true;
+    settings.AggregationWindow = 1;
+    settings.ReloadConfig = [&] { worker->UpdateSettings(newSettings); };
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "1_sensor/", settings);
+    worker = &w1_driver;
+    const auto pollInterval = chrono::hours(1);
+    w1_driver.RunIteration();
+    EXPECT_GT(w1_driver.GetNextIterationDelay(pollInterval), chrono::minutes(59));
+
+    // The device and controls of known thermometers are kept, controls are created and removed
+    // according to new settings by full scan right after the reload
+    Emit() << "Reload config";
+    Press(w1_driver, "reload_config");
+    EXPECT_EQ(w1_driver.GetNextIterationDelay(pollInterval), chrono::milliseconds(1));
+    w1_driver.RunIteration();
+    EXPECT_GT(w1_driver.GetNextIterationDelay(pollInterval), chrono::minutes(59));
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTimingTest, sample_times)
+{
+    const auto busDir = test_sensor_dir + "2_buses/w1_bus_master2";
+    SetBulkReadStatus(busDir, "0");
+    TOneWireDriverSettings settings;
+    settings.SampleTimes = true;
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/", settings);
+
+    w1_driver.RunIteration();
+    this_thread::sleep_for(chrono::milliseconds(100));
+    SetBulkReadStatus(busDir, "1");
+    auto conversionEnd = GetUnixTimeMs();
+    CompleteIteration(w1_driver);
+    auto end = GetUnixTimeMs();
+
+    // Values are sampled after conversion completion, the latency is time from the sample to publication.
+    // Time is mapped from steady clock to wall clock, so 1 ms error is allowed
+    for (const string id: {"28-00000a013000", "28-00000a013d97"}) {
+        auto sampleTimeControl = GetControl(id + "_sample_time");
+        auto latencyControl = GetControl(id + "_latency");
+        ASSERT_TRUE(sampleTimeControl && latencyControl);
+        auto sampleTime = stoll(sampleTimeControl->GetRawValue());
+        auto latency = stoll(latencyControl->GetRawValue());
+        EXPECT_GE(sampleTime, conversionEnd - 1);
+        EXPECT_LE(sampleTime, end + 1);
+        EXPECT_GE(latency, 0);
+        EXPECT_LE(sampleTime + latency, end + 1);
+        Emit() << id << "_sample_time and " << id << "_latency are published";
+    }
+
+    settings.SampleTimes = false;
+    w1_driver.UpdateSettings(settings);
+    CompleteIteration(w1_driver);
+    Emit() << "Sample times are disabled, controls exist: " << (GetControl("28-00000a013000_sample_time") != nullptr)
+           << " " << (GetControl("28-00000a013000_latency") != nullptr);
+}
+
+TEST_F(TOnewireDriverTest, priorities)
+{
+    // Without priorities 28-00000a013000 is published first as thermometers are ordered by identifier codes
+    TOneWireDriverSettings settings;
+    settings.Priorities["28-00000a013d97"] = 10;
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/", settings);
+    CompleteIteration(w1_driver);
+
+    Emit() << "Negative priority";
+    settings.Priorities["28-00000a013d97"] = -1;
+    w1_driver.UpdateSettings(settings);
+    CompleteIteration(w1_driver);
+    Emit() << "Clear()";
+}
+
+TEST_F(TOnewireDriverTimingTest, trigger_skew)
+{
+    const auto busDir = test_sensor_dir + "2_buses/w1_bus_master2";
+    SetBulkReadStatus(busDir, "0");
+    TOneWireDriverSettings settings;
+    settings.SynchronizedConversion = true;
+    settings.SysfsBackend = make_shared<TSlowDirectReadBackend>();
+    TOneWireDriverWorker w1_driver(DeviceId, Driver, Info, Debug, Error, test_sensor_dir + "2_buses/", settings);
+
+    // Without batch reading w1_slave entries are read after bulk conversion, so the start step doesn't block
+    auto start = chrono::steady_clock::now();
+    w1_driver.RunIteration();
+    EXPECT_LT(chrono::steady_clock::now() - start, chrono::milliseconds(100));
+    SetBulkReadStatus(busDir, "1");
+    CompleteIteration(w1_driver);
+    auto iterationTime = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+
+    // The skew is time between first and last conversion trigger, so it fits in the iteration
+    auto skewControl = GetControl("trigger_skew");
+    ASSERT_TRUE(skewControl);
+    auto skew = stoll(skewControl->GetRawValue());
+    EXPECT_GE(skew, 0);
+    EXPECT_LE(skew, iterationTime.count());
+    Emit() << "trigger_skew is published";
+
+    settings.SynchronizedConversion = false;
+    w1_driver.UpdateSettings(settings);
+    CompleteIteration(w1_driver);
+    Emit() << "Synchronized conversion is disabled, control exists: " << (GetControl("trigger_skew") != nullptr);
+}
@@ -0,0 +1,107 @@
+#include "onewire_family.h"
+#include <gtest/gtest.h>
+
+using namespace std;
+
+namespace
+{
+    vector<optional<double>> Parse(const TOneWireFamily& family, const vector<string>& attributes)
+    {
+        vector<TSysfsReadRequest> requests;
+        for (const auto& attribute: attributes) {
+            requests.push_back({"", attribute, true});
+        }
+        vector<optional<double>> values(family.Channels.size());
+        family.Parse(requests.data(), values.data());
+        return values;
+    }
+}
+
+TEST(TOneWireFamilyTest, find)
+{
+    ASSERT_NE(FindOneWireFamily("28-00000a013d97"), nullptr);
+    EXPECT_TRUE(FindOneWireFamily("28-00000a013d97")->Thermometer);
+    ASSERT_NE(FindOneWireFamily("26-000001b5c1e2"), nullptr);
+    EXPECT_EQ(FindOneWireFamily("26-000001b5c1e2")->Name, "DS2438");
+    EXPECT_EQ(FindOneWireFamily("01-000012345678"), nullptr);
+    EXPECT_EQ(FindOneWireFamily("28"), nullptr);
+    EXPECT_EQ(FindOneWireFamily("281-00000a013d97"), nullptr);
+
+    for (const auto& family: GetOneWireFamilies()) {
+        EXPECT_EQ(family.Thermometer, family.Parse == nullptr) << family.Name;
+    }
+}
+
+TEST(TOneWireFamilyTest, ds2438)
+{
+    const auto& family = *FindOneWireFamily("26-000001b5c1e2");
+    auto values = Parse(family, {"6400\n", "235\n", "500\n"});
+    ASSERT_EQ(values.size(), 4);
+    EXPECT_DOUBLE_EQ(*values[0], 25);
+    EXPECT_DOUBLE_EQ(*values[1], 2.35);
+    EXPECT_DOUBLE_EQ(*values[2], 5);
+    EXPECT_NEAR(*values[3], 49.97, 0.01);
+
+    // Negative temperature
+    values = Parse(family, {"-2560\n", "235\n", "500\n"});
+    EXPECT_DOUBLE_EQ(*values[0], -10);
+
+    // Humidity can't be calculated without supply voltage
+    values = Parse(family, {"6400\n", "235\n", "0\n"});
+    EXPECT_FALSE(values[3]);
+    values = Parse(family, {"6400\n", "235\n", "error\n"});
+    EXPECT_FALSE(values[2]);
+    EXPECT_FALSE(values[3]);
+}
+
+TEST(TOneWireFamilyTest, ds2408_ds2413)
+{
+    auto values = Parse(*FindOneWireFamily("29-00000012ab01"), {"\xa5"});
+    ASSERT_EQ(values.size(), 8);
+    vector<optional<double>> expected = {1, 0, 1, 0, 0, 1, 0, 1};
+    EXPECT_EQ(values, expected);
+
+    values = Parse(*FindOneWireFamily("3a-00000012cd01"), {"\xb4"});
+    expected = {0, 1};
+    EXPECT_EQ(values, expected);
+
+    values = Parse(*FindOneWireFamily("3a-00000012cd01"), {""});
+    EXPECT_FALSE(values[0]);
+    EXPECT_FALSE(values[1]);
+}
+
+TEST(TOneWireFamilyTest, ds2423)
+{
+    const auto& family = *FindOneWireFamily("1d-00000012ef01");
+    auto values = Parse(family, {"00 crc=YES c=0\n00 crc=YES c=0\n00 crc=YES c=1234\n00 crc=NO c=99\n"});
+    ASSERT_EQ(values.size(), 2);
+    EXPECT_EQ(values[0], 1234);
+    EXPECT_FALSE(values[1]);
+
+    // Counter B line is missing
+    values = Parse(family, {"00 crc=YES c=0\n00 crc=YES c=0\n00 crc=YES c=5\n"});
+    EXPECT_EQ(values[0], 5);
+    EXPECT_FALSE(values[1]);
+}
+
+TEST(TOneWireFamilyTest, rom_code)
+{
+    ASSERT_TRUE(ParseRomCode("28-00000a013d97"));
+    EXPECT_EQ(*ParseRomCode("28-00000a013d97"), 0x2800000a013d97);
+    EXPECT_EQ(*ParseRomCode("00-000000000000"), 0);
+    EXPECT_EQ(FormatRomCode(0x2800000a013d97), "28-00000a013d97");
+    EXPECT_EQ(FormatRomCode(*ParseRomCode("3a-ffffffffffff")), "3a-ffffffffffff");
+
+    // Keys are ordered as identifier codes
+    EXPECT_LT(*ParseRomCode("26-ffffffffffff"), *ParseRomCode("28-000000000000"));
+    EXPECT_LT(*ParseRomCode("28-00000a013000"), *ParseRomCode("28-00000a013d97"));
+
+    EXPECT_FALSE(ParseRomCode(""));
+    EXPECT_FALSE(ParseRomCode("28"));
+    EXPECT_FALSE(ParseRomCode("28-00000a013d97-wrong-crc"));
+    EXPECT_FALSE(ParseRomCode("28-00000a013d9"));
+    EXPECT_FALSE(ParseRomCode("28_00000a013d97"));
+    EXPECT_FALSE(ParseRomCode("28-00000A013D97"));
+    EXPECT_FALSE(ParseRomCode("28-+0000a013d97"));
+    EXPECT_FALSE(ParseRomCode("w1_bus_master1"));
+}
@@ -0,0 +1,175 @@
+#include "shm_export.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <limits>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class TShmExportTest: public ::testing::Test
+{
+protected:
+    string SegmentFile;
+
+    void SetUp() override
+    {
+        SegmentFile = ::testing::TempDir() + "wb-mqtt-w1-test-shm";
+    }
+};
+
+TEST_F(TShmExportTest, read)
+{
+    TShmExport shmExport(SegmentFile, 2);
+    TW1ShmReader reader(SegmentFile);
+    EXPECT_EQ(reader.GetCount(), 0);
+
+    EXPECT_TRUE(shmExport.Update("28-00000a013d97", W1_SHM_OK, 21.5, 1700000000123));
+    EXPECT_TRUE(shmExport.Update("28-00000a013000", W1_SHM_OK, -10.25, 1700000000456));
+    ASSERT_EQ(reader.GetCount(), 2);
+    EXPECT_EQ(reader.GetId(0), "28-00000a013d97");
+    EXPECT_EQ(reader.GetId(1), "28-00000a013000");
+    EXPECT_EQ(reader.Find("28-00000a013000"), 1);
+    EXPECT_FALSE(reader.Find("28-00000a013fff"));
+
+    TW1ShmReading reading;
+    ASSERT_TRUE(reader.Read(1, reading));
+    EXPECT_EQ(reading.Status, W1_SHM_OK);
+    EXPECT_EQ(reading.Temperature, -10.25);
+    EXPECT_EQ(reading.Timestamp, 1700000000456);
+
+    // Read error keeps last value
+    EXPECT_TRUE(shmExport.Update("28-00000a013000", W1_SHM_READ_ERROR, 0, 1700000000789));
+    ASSERT_TRUE(reader.TryRead(1, reading));
+    EXPECT_EQ(reading.Status, W1_SHM_READ_ERROR);
+    EXPECT_EQ(reading.Temperature, -10.25);
+    EXPECT_EQ(reading.Timestamp, 1700000000789);
+
+    EXPECT_EQ(reading.GetId(), "28-00000a013000");
+
+    // No free records
+    EXPECT_FALSE(shmExport.Update("28-00000a013fff", W1_SHM_OK, 1, 1));
+    EXPECT_EQ(reader.GetCount(), 2);
+
+    EXPECT_TRUE(shmExport.Update("28-00000a013d97", W1_SHM_DISCONNECTED, 0, 1700000001000));
+    ASSERT_TRUE(reader.Read(0, reading));
+    EXPECT_EQ(reading.Status, W1_SHM_DISCONNECTED);
+
+    // Too long identifier code
+    TShmExport shmExport2(SegmentFile, 2);
+    EXPECT_FALSE(shmExport2.Update(string(W1_SHM_ID_SIZE, '2'), W1_SHM_OK, 1, 1));
+}
+
+TEST_F(TShmExportTest, reuse_disconnected)
+{
+    TShmExport shmExport(SegmentFile, 3);
+    TW1ShmReader reader(SegmentFile);
+    EXPECT_TRUE(shmExport.Update("28-00000a013001", W1_SHM_OK, 1, 1000));
+    EXPECT_TRUE(shmExport.Update("28-00000a013002", W1_SHM_OK, 2, 1000));
+    EXPECT_TRUE(shmExport.Update("28-00000a013003", W1_SHM_OK, 3, 1000));
+    EXPECT_TRUE(shmExport.Update("28-00000a013002", W1_SHM_DISCONNECTED, 0, 2000));
+    EXPECT_TRUE(shmExport.Update("28-00000a013001", W1_SHM_DISCONNECTED, 0, 3000));
+
+    // The record of the thermometer disconnected for the longest time is reused, its value is not shown
+    EXPECT_TRUE(shmExport.Update("28-00000a013004", W1_SHM_READ_ERROR, 0, 4000));
+    EXPECT_EQ(reader.GetCount(), 3);
+    EXPECT_EQ(reader.Find("28-00000a013004"), 1);
+    EXPECT_FALSE(reader.Find("28-00000a013002"));
+    TW1ShmReading reading;
+    ASSERT_TRUE(reader.Read(1, reading));
+    EXPECT_EQ(reading.GetId(), "28-00000a013004");
+    EXPECT_EQ(reading.Status, W1_SHM_READ_ERROR);
+    EXPECT_EQ(reading.Temperature, 0);
+    EXPECT_EQ(reading.Timestamp, 4000);
+
+    // Reconnected thermometer gets the last disconnected record
+    EXPECT_TRUE(shmExport.Update("28-00000a013002", W1_SHM_OK, 5, 5000));
+    EXPECT_EQ(reader.Find("28-00000a013002"), 0);
+    EXPECT_FALSE(reader.Find("28-00000a013001"));
+
+    // Disconnection of a thermometer without record doesn't take a record
+    EXPECT_FALSE(shmExport.Update("28-00000a013001", W1_SHM_DISCONNECTED, 0, 5000));
+    EXPECT_FALSE(reader.Find("28-00000a013001"));
+
+    // Connected thermometers' records are never reused
+    EXPECT_FALSE(shmExport.Update("28-00000a013005", W1_SHM_OK, 6, 6000));
+    EXPECT_EQ(reader.GetId(2), "28-00000a013003");
+}
+
+TEST_F(TShmExportTest, bad_segment)
+{
+    EXPECT_THROW(TW1ShmReader{SegmentFile + ".absent"}, system_error);
+    {
+        TShmExport shmExport(SegmentFile, 1);
+    }
+    // The segment is removed with the writer
+    EXPECT_THROW(TW1ShmReader{SegmentFile}, system_error);
+
+    FILE* f = fopen(SegmentFile.c_str(), "w");
+    ASSERT_TRUE(f);
+    fputs(string(128, 'x').c_str(), f);
+    fclose(f);
+    EXPECT_THROW(TW1ShmReader{SegmentFile}, runtime_error);
+    remove(SegmentFile.c_str());
+}
+
+TEST_F(TShmExportTest, bad_capacity)
+{
+    EXPECT_LE(TShmExport::GetMaxCapacity(), numeric_limits<uint32_t>::max());
+    EXPECT_THROW(TShmExport(SegmentFile, 0), invalid_argument);
+    EXPECT_THROW(TShmExport(SegmentFile, TShmExport::GetMaxCapacity() + 1), invalid_argument);
+    EXPECT_THROW(TW1ShmReader{SegmentFile}, system_error);
+}
+
+TEST_F(TShmExportTest, concurrent_read)
+{
+    const size_t SENSORS = 4;
+    const int64_t UPDATES = 200000;
+    TShmExport shmExport(SegmentFile, SENSORS);
+    for (size_t i = 0; i < SENSORS; ++i) {
+        shmExport.Update("28-00000a01300" + to_string(i), W1_SHM_OK, 0, 0);
+    }
+
+    // Temperature and timestamp are written as a pair, a reader must never see them from different updates
+    atomic<bool> done{false};
+    atomic<size_t> torn{0};
+    vector<thread> readers;
+    vector<size_t> successes(3);
+    for (size_t r = 0; r < successes.size(); ++r) {
+        readers.emplace_back([&, r] {
+            TW1ShmReader reader(SegmentFile);
+            vector<int64_t> lastTimestamps(SENSORS);
+            do {
+                for (size_t i = 0; i < SENSORS; ++i) {
+                    TW1ShmReading reading;
+                    if (!reader.TryRead(i, reading)) {
+                        continue;
+                    }
+                    ++successes[r];
+                    if (reading.Temperature != static_cast<double>(reading.Timestamp) * 0.5 ||
+                        reading.Timestamp < lastTimestamps[i])
+                    {
+                        ++torn;
+                    }
+                    lastTimestamps[i] = reading.Timestamp;
+                }
+            } while (!done.load());
+        });
+    }
+    for (int64_t n = 1; n <= UPDATES; ++n) {
+        shmExport.Update("28-00000a01300" + to_string(n % SENSORS), W1_SHM_OK, n * 0.5, n);
+    }
+    done = true;
+    for (auto& reader: readers) {
+        reader.join();
+    }
+    EXPECT_EQ(torn.load(), 0);
+    for (auto count: successes) {
+        EXPECT_GT(count, 0);
+    }
+
+    TW1ShmReader reader(SegmentFile);
+    TW1ShmReading reading;
+    ASSERT_TRUE(reader.Read(UPDATES % SENSORS, reading));
+    EXPECT_EQ(reading.Timestamp, UPDATES);
+}
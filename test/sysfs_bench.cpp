@@ -0,0 +1,95 @@
+#include "file_utils.h"
+#include "sysfs_io_uring.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+
+using namespace std;
+using namespace std::chrono;
+
+/*
+    Compares reading of thermometers sysfs entries one by one with plain system calls
+    and in one batch with io_uring.
+
+    Usage: wb-mqtt-w1-bench [devices_dir] [cycles] [copies]
+        devices_dir - directory with bus masters, default: fake_sensors/2_buses/
+        cycles      - number of polling cycles, default: 10000
+        copies      - every entry is read 'copies' times per cycle to emulate big installations, default: 50
+*/
+
+namespace
+{
+    vector<TSysfsReadRequest> MakeRequests(const string& devicesDir, size_t copies)
+    {
+        vector<string> paths;
+        TPlainSysfsBackend backend;
+        IterateDir(devicesDir, [&](const auto& busMaster) {
+            if (busMaster.rfind("w1_bus_master", 0) != 0) {
+                return false;
+            }
+            IterateDir(devicesDir + busMaster, [&](const auto& device) {
+                for (const auto& entry: {"/temperature", "/w1_slave"}) {
+                    auto path = devicesDir + busMaster + "/" + device + entry;
+                    if (backend.Exists(path)) {
+                        paths.push_back(path);
+                        break;
+                    }
+                }
+                return false;
+            });
+            return false;
+        });
+        vector<TSysfsReadRequest> requests;
+        for (size_t i = 0; i < copies; ++i) {
+            for (const auto& path: paths) {
+                requests.push_back({path, string(), false});
+            }
+        }
+        return requests;
+    }
+
+    void Run(const string& name, ISysfsBackend& backend, vector<TSysfsReadRequest>& requests, size_t cycles)
+    {
+        rusage before, after;
+        getrusage(RUSAGE_SELF, &before);
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < cycles; ++i) {
+            backend.ReadFiles(requests);
+        }
+        auto time = duration_cast<duration<double, micro>>(steady_clock::now() - start);
+        getrusage(RUSAGE_SELF, &after);
+        auto contextSwitches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+        auto systemTime = (after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e6 +
+                          (after.ru_stime.tv_usec - before.ru_stime.tv_usec);
+        cout << setw(8) << name << ": " << fixed << setprecision(1) << time.count() / cycles << " us/cycle, "
+             << systemTime / cycles << " us/cycle in kernel, " << setprecision(3)
+             << static_cast<double>(contextSwitches) / cycles << " context switches/cycle" << endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    string devicesDir = (argc > 1) ? argv[1] : "fake_sensors/2_buses/";
+    if (devicesDir.back() != '/') {
+        devicesDir += '/';
+    }
+    size_t cycles = (argc > 2) ? stoul(argv[2]) : 10000;
+    size_t copies = (argc > 3) ? stoul(argv[3]) : 50;
+
+    try {
+        auto requests = MakeRequests(devicesDir, copies);
+        cout << requests.size() << " files per cycle, " << cycles << " cycles" << endl;
+
+        TPlainSysfsBackend plainBackend;
+        Run("plain", plainBackend, requests, cycles);
+
+        TIoUringSysfsBackend ioUringBackend;
+        Run("io_uring", ioUringBackend, requests, cycles);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "sysfs_io_uring.h"
+#include "sysfs_w1.h"
+#include <atomic>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+#include <wblib/testing/testlog.h>
+
+using namespace std;
+using namespace WBMQTT;
+using namespace WBMQTT::Testing;
+
+class TIoUringSysfsBackendTest: public TLoggedFixture
+{
+protected:
+    string test_sensor_root_dir;
+    shared_ptr<TIoUringSysfsBackend> Backend;
+
+    void SetUp()
+    {
+        char* d = getenv("TEST_DIR_ABS");
+        if (d != NULL) {
+            test_sensor_root_dir = d;
+            test_sensor_root_dir += '/';
+        }
+        test_sensor_root_dir += "fake_sensors/";
+        try {
+            // Small queue to check splitting of big batches
+            Backend = make_shared<TIoUringSysfsBackend>(2);
+        } catch (const exception& e) {
+            GTEST_SKIP() << e.what();
+        }
+    }
+
+    vector<TSysfsReadRequest> MakeRequests()
+    {
+        vector<TSysfsReadRequest> requests;
+        for (const auto& path: {"1_sensor/w1_bus_master1/28-00000a013d97/w1_slave",
+                                "2_sensor/w1_bus_master1/28-00000a013000-wrong-crc/w1_slave",
+                                "no_sensor/w1_bus_master1/28-00000a013d97/w1_slave",
+                                "2_buses/w1_bus_master2/28-00000a013000/temperature",
+                                "power_modes/w1_bus_master1/28-00000a013001/ext_power"})
+        {
+            requests.push_back({test_sensor_root_dir + path, "garbage", false});
+        }
+        return requests;
+    }
+};
+
+TEST_F(TIoUringSysfsBackendTest, same_as_plain)
+{
+    auto requests = MakeRequests();
+    Backend->ReadFiles(requests);
+
+    auto expected = MakeRequests();
+    TPlainSysfsBackend plainBackend;
+    plainBackend.ReadFiles(expected);
+
+    ASSERT_EQ(requests.size(), expected.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        EXPECT_EQ(requests[i].Ok, expected[i].Ok) << requests[i].Path;
+        if (expected[i].Ok) {
+            EXPECT_EQ(requests[i].Content, expected[i].Content) << requests[i].Path;
+        }
+    }
+    EXPECT_FALSE(requests[2].Ok);
+}
+
+TEST_F(TIoUringSysfsBackendTest, batch_read)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "1";
+    f.close();
+
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error, nullptr, Backend);
+    m.SetBatchRead(true);
+    auto devices = m.RescanBusAndRead();
+    ASSERT_EQ(devices.size(), 2);
+    EXPECT_EQ(devices[1]->GetId(), "28-00000a013d97");
+    EXPECT_EQ(to_string(devices[1]->GetTemperature()), "26.312000");
+}
+
+TEST_F(TIoUringSysfsBackendTest, shards)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "1";
+    f.close();
+
+    // Shards of one worker thread each share the backend, their batches must not be mixed up
+    const int ITERATIONS = 300;
+    atomic<int> errors{0};
+    vector<thread> shards;
+    for (const auto& busMaster: {"w1_bus_master1", "w1_bus_master2"}) {
+        shards.emplace_back([&, busMaster] {
+            TSysfsOneWireManager m(test_sensor_root_dir + string("2_buses/"), Debug, Error, nullptr, Backend);
+            TOneWireDeviceFilter filter;
+            filter.BusMasters = {busMaster};
+            m.SetFilter(filter);
+            m.SetBatchRead(true);
+            for (int i = 0; i < ITERATIONS; ++i) {
+                const auto& devices = m.RescanBusAndRead();
+                try {
+                    if (devices.size() != 1 || devices[0]->GetTemperature() != 26.312) {
+                        ++errors;
+                    }
+                } catch (const exception&) {
+                    ++errors;
+                }
+            }
+        });
+    }
+    for (auto& shard: shards) {
+        shard.join();
+    }
+    EXPECT_EQ(errors.load(), 0);
+}
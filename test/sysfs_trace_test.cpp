@@ -0,0 +1,126 @@
+#include "sysfs_trace.h"
+#include "sysfs_w1.h"
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <thread>
+#include <wblib/testing/testlog.h>
+
+using namespace std;
+using namespace WBMQTT;
+using namespace WBMQTT::Testing;
+
+namespace
+{
+    //! Reads files of a batch concurrently, the batch takes BATCH_TIME regardless of number of files
+    class TConcurrentBatchBackend: public TPlainSysfsBackend
+    {
+    public:
+        static constexpr auto BATCH_TIME = chrono::milliseconds(200);
+
+        void ReadFiles(vector<TSysfsReadRequest>& requests) override
+        {
+            this_thread::sleep_for(BATCH_TIME);
+            TPlainSysfsBackend::ReadFiles(requests);
+        }
+    };
+}
+
+class TSysfsTraceTest: public TLoggedFixture
+{
+protected:
+    filesystem::path WorkDir;
+    string DevicesDir;
+    string TraceFile;
+
+    void SetUp()
+    {
+        string testDir;
+        char* d = getenv("TEST_DIR_ABS");
+        if (d != NULL) {
+            testDir = d;
+            testDir += '/';
+        }
+        WorkDir = filesystem::temp_directory_path() / ("wb-mqtt-w1-trace-test-" + to_string(getpid()));
+        filesystem::remove_all(WorkDir);
+        filesystem::create_directories(WorkDir);
+        filesystem::copy(testDir + "fake_sensors/2_buses", WorkDir / "devices", filesystem::copy_options::recursive);
+        DevicesDir = (WorkDir / "devices").string() + "/";
+        // Conversion is completed
+        ofstream(DevicesDir + "w1_bus_master2/therm_bulk_read", ofstream::trunc) << "1";
+        TraceFile = (WorkDir / "trace.txt").string();
+    }
+
+    void TearDown()
+    {
+        filesystem::remove_all(WorkDir);
+    }
+
+    vector<pair<string, string>> Read(PSysfsBackend backend)
+    {
+        TSysfsOneWireManager manager(DevicesDir, Debug, Error, nullptr, backend);
+        vector<pair<string, string>> res;
+        for (const auto& sensor: manager.RescanBusAndRead()) {
+            try {
+                res.emplace_back(sensor->GetId(), to_string(sensor->GetTemperature()));
+            } catch (const exception& e) {
+                res.emplace_back(sensor->GetId(), e.what());
+            }
+        }
+        return res;
+    }
+};
+
+TEST_F(TSysfsTraceTest, record_and_replay)
+{
+    auto recorded = Read(make_shared<TRecordingSysfsBackend>(nullptr, TraceFile));
+    ASSERT_EQ(recorded.size(), 2);
+    EXPECT_EQ(recorded[0].second, "26.312000");
+
+    // Replay doesn't touch sysfs
+    filesystem::remove_all(WorkDir / "devices");
+    auto replayed = Read(make_shared<TReplaySysfsBackend>(TraceFile, 0));
+    EXPECT_EQ(replayed, recorded);
+}
+
+TEST_F(TSysfsTraceTest, not_recorded_request)
+{
+    Read(make_shared<TRecordingSysfsBackend>(nullptr, TraceFile));
+    TReplaySysfsBackend backend(TraceFile, 0);
+    string content;
+    EXPECT_THROW(backend.ReadFile(DevicesDir + "unknown", content), runtime_error);
+}
+
+TEST_F(TSysfsTraceTest, malformed_trace)
+{
+    ofstream(TraceFile) << "garbage" << endl;
+    EXPECT_THROW(TReplaySysfsBackend(TraceFile, 0), runtime_error);
+}
+
+TEST_F(TSysfsTraceTest, replay_batch_time)
+{
+    vector<TSysfsReadRequest> requests(4);
+    for (size_t i = 0; i < requests.size(); ++i) {
+        requests[i].Path = DevicesDir + (i % 2 ? "w1_bus_master1/28-00000a013d97/w1_slave"
+                                               : "w1_bus_master2/28-00000a013000/temperature");
+    }
+    TRecordingSysfsBackend(make_shared<TConcurrentBatchBackend>(), TraceFile).ReadFiles(requests);
+
+    // The batch takes recorded time both by batch and by file reads
+    TReplaySysfsBackend batchBackend(TraceFile);
+    auto start = chrono::steady_clock::now();
+    batchBackend.ReadFiles(requests);
+    auto elapsed = chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, TConcurrentBatchBackend::BATCH_TIME - chrono::milliseconds(1));
+    EXPECT_LT(elapsed, TConcurrentBatchBackend::BATCH_TIME * 3 / 2);
+    EXPECT_TRUE(requests[1].Ok);
+    EXPECT_EQ(requests[1].Content.substr(0, 2), "a5");
+
+    TReplaySysfsBackend fileBackend(TraceFile);
+    start = chrono::steady_clock::now();
+    for (auto& request: requests) {
+        request.Ok = fileBackend.ReadFile(request.Path, request.Content);
+    }
+    elapsed = chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, TConcurrentBatchBackend::BATCH_TIME - chrono::milliseconds(1));
+    EXPECT_LT(elapsed, TConcurrentBatchBackend::BATCH_TIME * 3 / 2);
+}
@@ -1,7 +1,9 @@
 #include "sysfs_w1.h"
 #include <fstream>
 #include <gtest/gtest.h>
+#include <thread>
 #include <wblib/testing/testlog.h>
+#include <wblib/utils.h>
 
 using namespace std;
 using namespace WBMQTT;
@@ -31,6 +33,17 @@ TEST_F(TSysfsOnewireDeviceTest, name)
     EXPECT_EQ(s.GetId(), "sensor_name");
 }
 
+TEST_F(TSysfsOnewireDeviceTest, bus_switch)
+{
+    TSysfsOneWireThermometer s("28-00000a013d97", "/sys/bus/w1/devices/w1_bus_master10");
+    EXPECT_EQ(s.GetRomCode(), 0x2800000a013d97);
+    EXPECT_TRUE(s.FoundAgain("/sys/bus/w1/devices/w1_bus_master10"));
+    // Bus directory with the same prefix is another bus
+    EXPECT_FALSE(s.FoundAgain("/sys/bus/w1/devices/w1_bus_master1"));
+    EXPECT_EQ(s.GetBusDir(), "/sys/bus/w1/devices/w1_bus_master1");
+    EXPECT_EQ(TSysfsOneWireThermometer("sensor_name", "asd").GetRomCode(), 0);
+}
+
 TEST_F(TSysfsOnewireDeviceTest, 1_sensor_read)
 {
     auto s1 = TSysfsOneWireThermometer("28-00000a013d97", test_sensor_root_dir + string("1_sensor/w1_bus_master1/"));
@@ -51,6 +64,28 @@ TEST_F(TSysfsOnewireDeviceTest, wrong_crc)
     ASSERT_THROW(s1.GetTemperature(), runtime_error);
 }
 
+TEST_F(TSysfsOnewireDeviceTest, error_kind)
+{
+    auto s1 = TSysfsOneWireThermometer("28-00000a013000-wrong-crc",
+                                       test_sensor_root_dir + string("2_sensor/w1_bus_master1/"));
+    try {
+        s1.GetTemperature();
+        FAIL() << "TOneWireReadErrorException is expected";
+    } catch (const TOneWireReadErrorException& e) {
+        EXPECT_EQ(e.GetKind(), TOneWireReadErrorException::CrcError);
+        EXPECT_EQ(string(e.what()),
+                  "Bad CRC (" + test_sensor_root_dir + "2_sensor/w1_bus_master1//28-00000a013000-wrong-crc/w1_slave)");
+    }
+
+    auto s2 = TSysfsOneWireThermometer("28-00000a013d97", test_sensor_root_dir + string("no_sensor/w1_bus_master1/"));
+    try {
+        s2.GetTemperature();
+        FAIL() << "TOneWireReadErrorException is expected";
+    } catch (const TOneWireReadErrorException& e) {
+        EXPECT_EQ(e.GetKind(), TOneWireReadErrorException::OpenError);
+    }
+}
+
 TEST_F(TSysfsOnewireDeviceTest, 1_sensor_85_degree_ok)
 {
     std::ofstream stream(test_sensor_root_dir + string("error_sensor/w1_bus_master1/28-00001080d4ad/temperature"));
@@ -131,4 +166,410 @@ TEST_F(TSysfsOnewireManagerTest, 2_buses)
     f.close();
     auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
     EXPECT_EQ(m.RescanBusAndRead().size(), 2);
-}
\ No newline at end of file
+}
+TEST_F(TSysfsOnewireManagerTest, filter)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    TOneWireDeviceFilter filter;
+    filter.BusMasters = {"w1_bus_master2", "w1_bus_master3"};
+    m.SetFilter(filter);
+    auto devices = m.RescanBusAndRead();
+    ASSERT_EQ(devices.size(), 1);
+    EXPECT_EQ(devices[0]->GetId(), "28-00000a013000");
+
+    filter.BusMasters.clear();
+    filter.SensorIds = {"28-*d97"};
+    m.SetFilter(filter);
+    devices = m.RescanBusAndRead();
+    ASSERT_EQ(devices.size(), 2);
+    EXPECT_EQ(devices[0]->GetStatus(), TSysfsOneWireThermometer::Disconnected);
+    EXPECT_EQ(devices[1]->GetId(), "28-00000a013d97");
+    EXPECT_EQ(devices[1]->GetStatus(), TSysfsOneWireThermometer::New);
+}
+
+namespace
+{
+    // Reads files as is, but only records writes
+    class TWriteRecordingBackend: public TPlainSysfsBackend
+    {
+    public:
+        vector<string> Writes;
+
+        bool WriteFile(const string& path, const string& data) override
+        {
+            Writes.push_back(path.substr(path.rfind('/') + 1) + "=" + data);
+            return true;
+        }
+    };
+}
+
+TEST_F(TSysfsOnewireManagerTest, explicit_search)
+{
+    auto backend = make_shared<TWriteRecordingBackend>();
+    {
+        auto m = TSysfsOneWireManager(test_sensor_root_dir + string("kernel_search/"), Debug, Error, nullptr, backend);
+        m.SetExplicitSearch(true);
+
+        // Devices are taken from w1_master_slaves, stale directory is ignored
+        auto devices = m.RescanBusAndRead();
+        ASSERT_EQ(devices.size(), 2);
+        EXPECT_EQ(devices[0]->GetId(), "28-00000a013101");
+        EXPECT_EQ(devices[1]->GetId(), "28-00000a013102");
+        EXPECT_EQ(backend->Writes, vector<string>({"w1_master_search=0"}));
+
+        m.TriggerSearch();
+        m.RescanBusAndRead();
+        EXPECT_EQ(backend->Writes, vector<string>({"w1_master_search=0", "w1_master_search=1"}));
+    }
+    EXPECT_EQ(backend->Writes, vector<string>({"w1_master_search=0", "w1_master_search=1", "w1_master_search=-1"}));
+}
+
+TEST_F(TSysfsOnewireManagerTest, mixed_bus)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("mixed_bus/"), Debug, Error);
+    auto thermometers = m.RescanBusAndRead();
+    ASSERT_EQ(thermometers.size(), 1);
+    EXPECT_EQ(thermometers[0]->GetId(), "28-00000a013201");
+    EXPECT_EQ(thermometers[0]->GetTemperature(), 21.5);
+
+    // Devices of unsupported families are ignored
+    auto devices = m.GetDevices();
+    ASSERT_EQ(devices.size(), 4);
+    EXPECT_EQ(devices[0]->GetId(), "1d-00000012ef01");
+    EXPECT_EQ(devices[0]->GetValues(), vector<optional<double>>({1234, nullopt}));
+    EXPECT_EQ(devices[1]->GetId(), "26-000001b5c1e2");
+    EXPECT_EQ(devices[1]->GetStatus(), TSysfsOneWireThermometer::New);
+    EXPECT_EQ(devices[1]->GetValues()[0], 25);
+    EXPECT_NEAR(*devices[1]->GetValues()[3], 49.97, 0.01);
+    EXPECT_EQ(devices[2]->GetId(), "29-00000012ab01");
+    EXPECT_EQ(devices[2]->GetValues(), vector<optional<double>>({1, 0, 1, 0, 0, 1, 0, 1}));
+    EXPECT_EQ(devices[3]->GetId(), "3a-00000012cd01");
+    EXPECT_EQ(devices[3]->GetValues(), vector<optional<double>>({0, 1}));
+
+    TOneWireDeviceFilter filter;
+    filter.SensorIds = {"28-*", "3a-*"};
+    m.SetFilter(filter);
+    m.RescanBusAndRead();
+    devices = m.GetDevices();
+    ASSERT_EQ(devices.size(), 4);
+    EXPECT_EQ(devices[0]->GetStatus(), TSysfsOneWireThermometer::Disconnected);
+    EXPECT_EQ(devices[3]->GetStatus(), TSysfsOneWireThermometer::Connected);
+
+    m.RescanBusAndRead();
+    devices = m.GetDevices();
+    ASSERT_EQ(devices.size(), 1);
+    EXPECT_EQ(devices[0]->GetId(), "3a-00000012cd01");
+}
+
+TEST_F(TSysfsOnewireManagerTest, read_buses)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "1";
+    f.close();
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    EXPECT_EQ(m.ReadBuses({test_sensor_root_dir + "2_buses/w1_bus_master2"}).size(), 0);
+    EXPECT_EQ(m.RescanBusAndRead().size(), 2);
+    auto res = m.ReadBuses({test_sensor_root_dir + "2_buses/w1_bus_master2"});
+    ASSERT_EQ(res.size(), 1);
+    EXPECT_EQ(res[0]->GetId(), "28-00000a013000");
+    EXPECT_EQ(to_string(res[0]->GetTemperature()), "26.312000");
+}
+
+TEST_F(TSysfsOnewireManagerTest, power_modes)
+{
+    const auto dir = test_sensor_root_dir + "power_modes/";
+    for (const auto& bus: {"w1_bus_master1", "w1_bus_master2"}) {
+        std::ofstream f;
+        f.open(dir + bus + "/therm_bulk_read", std::ofstream::trunc);
+        f << "1";
+    }
+    auto m = TSysfsOneWireManager(dir, Debug, Error);
+    auto res = m.RescanBusAndRead();
+    EXPECT_EQ(m.GetBusPowerMode(dir + "w1_bus_master1"), TSysfsOneWireManager::ParasitePower);
+    EXPECT_EQ(m.GetBusPowerMode(dir + "w1_bus_master2"), TSysfsOneWireManager::ExternalPower);
+    ASSERT_EQ(res.size(), 3);
+
+    // Thermometers on parasite powered bus are converted one by one using w1_slave
+    EXPECT_EQ(to_string(res[0]->GetTemperature()), "21.000000");
+    EXPECT_EQ(to_string(res[1]->GetTemperature()), "22.500000");
+
+    // Bulk conversion on externally powered bus
+    EXPECT_EQ(to_string(res[2]->GetTemperature()), "23.000000");
+}
+
+TEST_F(TSysfsOnewireManagerTest, conversion_time)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "1";
+    f.close();
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    m.RescanBusAndRead();
+    auto conversionTime = m.GetBusConversionTime(test_sensor_root_dir + "2_buses/w1_bus_master2");
+
+    // Conversion is completed at first check
+    EXPECT_LT(conversionTime.count(), 100);
+
+    // Buses without bulk read support don't have conversion time
+    EXPECT_EQ(m.GetBusConversionTime(test_sensor_root_dir + "2_buses/w1_bus_master1").count(), 0);
+}
+
+TEST_F(TSysfsOnewireManagerTest, conversion_time_learning)
+{
+    const auto statusFile = test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read";
+    auto setStatus = [&](const char* status) {
+        std::ofstream f;
+        f.open(statusFile, std::ofstream::trunc);
+        f << status;
+    };
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    for (int i = 0; i < 3; ++i) {
+        setStatus("0");
+        std::thread converter([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            setStatus("1");
+        });
+        auto start = std::chrono::steady_clock::now();
+        m.RescanBusAndRead();
+        auto duration = std::chrono::steady_clock::now() - start;
+        converter.join();
+        EXPECT_GE(duration, std::chrono::milliseconds(300));
+        EXPECT_LT(duration, std::chrono::milliseconds(700));
+    }
+    auto conversionTime = m.GetBusConversionTime(test_sensor_root_dir + "2_buses/w1_bus_master2");
+    EXPECT_GE(conversionTime.count(), 300);
+    EXPECT_LT(conversionTime.count(), 500);
+}
+
+TEST_F(TSysfsOnewireManagerTest, conversion_timeout)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "0";
+    f.close();
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    auto start = std::chrono::steady_clock::now();
+    auto res = m.RescanBusAndRead();
+    auto duration = std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(res.size(), 2);
+
+    // Unfinished conversion is counted as a sample of the whole wait
+    auto conversionTime = m.GetBusConversionTime(test_sensor_root_dir + "2_buses/w1_bus_master2");
+    EXPECT_GE(conversionTime, std::chrono::milliseconds(1800));
+    EXPECT_LE(conversionTime, duration);
+
+    // The value is read right after the wait
+    res[0]->GetTemperature();
+    EXPECT_GE(res[0]->GetSampleTime(), start + conversionTime);
+}
+
+TEST_F(TSysfsOnewireManagerTest, cancel_conversion)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "0";
+    f.close();
+    TCancellationToken token;
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error, &token);
+    std::thread canceller([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        token.Cancel();
+    });
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(m.RescanBusAndRead().size(), 2);
+    auto duration = std::chrono::steady_clock::now() - start;
+    canceller.join();
+
+    // Conversion never completes, without cancellation the manager waits for 2 s
+    EXPECT_LT(duration, std::chrono::milliseconds(500));
+}
+
+TEST_F(TSysfsOnewireManagerTest, conversion_steps)
+{
+    const auto statusFile = test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read";
+    auto setStatus = [&](const char* status) {
+        std::ofstream f;
+        f.open(statusFile, std::ofstream::trunc);
+        f << status;
+    };
+    setStatus("0");
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    auto start = std::chrono::steady_clock::now();
+    m.StartRescan();
+    std::chrono::steady_clock::time_point nextCheck;
+    EXPECT_FALSE(m.CheckConversions(nextCheck));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_GT(nextCheck, start);
+
+    setStatus("1");
+    std::this_thread::sleep_until(nextCheck);
+    EXPECT_TRUE(m.CheckConversions(nextCheck));
+    const auto& res = m.CompleteRead();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(to_string(res[0]->GetTemperature()), "26.312000");
+    EXPECT_EQ(to_string(res[1]->GetTemperature()), "26.312000");
+}
+
+TEST_F(TSysfsOnewireManagerTest, sample_time)
+{
+    const auto statusFile = test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read";
+    auto setStatus = [&](const char* status) {
+        std::ofstream f;
+        f.open(statusFile, std::ofstream::trunc);
+        f << status;
+    };
+    setStatus("0");
+    std::thread converter([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        setStatus("1");
+    });
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    auto start = std::chrono::steady_clock::now();
+    auto res = m.RescanBusAndRead();
+    auto end = std::chrono::steady_clock::now();
+    converter.join();
+    ASSERT_EQ(res.size(), 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Bulk conversion is completed during RescanBusAndRead, not when the value is read
+    EXPECT_EQ(res[0]->GetBusDir(), test_sensor_root_dir + "2_buses/w1_bus_master2");
+    res[0]->GetTemperature();
+    EXPECT_GE(res[0]->GetSampleTime(), start + std::chrono::milliseconds(300));
+    EXPECT_LE(res[0]->GetSampleTime(), end);
+
+    // Direct conversion is done while w1_slave entry is read
+    auto readStart = std::chrono::steady_clock::now();
+    res[1]->GetTemperature();
+    EXPECT_GE(res[1]->GetSampleTime(), readStart);
+    EXPECT_LE(res[1]->GetSampleTime(), std::chrono::steady_clock::now());
+}
+
+TEST_F(TSysfsOnewireManagerTest, priorities)
+{
+    std::ofstream f;
+    f.open(test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read", std::ofstream::trunc);
+    f << "1";
+    f.close();
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    auto res = m.RescanBusAndRead();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(res[0]->GetId(), "28-00000a013000");
+    EXPECT_EQ(res[1]->GetId(), "28-00000a013d97");
+
+    // Priorities of known thermometers are changed right away
+    m.SetPriorities({{"28-00000a013d97", 10}});
+    res = m.RescanBusAndRead();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(res[0]->GetId(), "28-00000a013d97");
+    EXPECT_EQ(res[1]->GetId(), "28-00000a013000");
+
+    res = m.ReadBuses(
+        {test_sensor_root_dir + "2_buses/w1_bus_master1", test_sensor_root_dir + "2_buses/w1_bus_master2"});
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(res[0]->GetId(), "28-00000a013d97");
+
+    // New thermometers get priorities on discovery
+    auto m2 = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    m2.SetPriorities({{"28-00000a013000", -1}, {"28-00000a013d97", -1}});
+    res = m2.RescanBusAndRead();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(res[0]->GetId(), "28-00000a013000");
+    EXPECT_EQ(res[0]->GetPriority(), -1);
+}
+
+namespace
+{
+    // Reads w1_slave entries with a delay like a thermometer converting during the read
+    class TSlowDirectReadBackend: public TPlainSysfsBackend
+    {
+    public:
+        std::chrono::milliseconds Delay = std::chrono::milliseconds::zero();
+
+        bool ReadFile(const string& path, string& content) override
+        {
+            if (StringHasSuffix(path, "/w1_slave")) {
+                std::this_thread::sleep_for(Delay);
+            }
+            return TPlainSysfsBackend::ReadFile(path, content);
+        }
+    };
+}
+
+TEST_F(TSysfsOnewireManagerTest, synchronized_conversion)
+{
+    const auto statusFile = test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read";
+    auto setStatus = [&](const char* status) {
+        std::ofstream f;
+        f.open(statusFile, std::ofstream::trunc);
+        f << status;
+    };
+    setStatus("0");
+    std::thread converter([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        setStatus("1");
+    });
+    auto backend = make_shared<TSlowDirectReadBackend>();
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error, nullptr, backend);
+    m.SetSynchronizedConversion(true);
+    m.SetBatchRead(true);
+    auto start = std::chrono::steady_clock::now();
+    auto res = m.RescanBusAndRead();
+    converter.join();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_LT(m.GetTriggerSkew(), std::chrono::milliseconds(100));
+
+    // Bulk conversion
+    EXPECT_TRUE(res[0]->IsBulkRead());
+    EXPECT_EQ(to_string(res[0]->GetTemperature()), "26.312000");
+    EXPECT_GE(res[0]->GetSampleTime(), start + std::chrono::milliseconds(300));
+
+    // Thermometer on the bus without bulk conversion is read right after the trigger, not after bulk conversion
+    EXPECT_FALSE(res[1]->IsBulkRead());
+    EXPECT_EQ(to_string(res[1]->GetTemperature()), "26.312000");
+    EXPECT_LT(res[1]->GetSampleTime(), start + std::chrono::milliseconds(300));
+
+    // Reading of w1_slave takes longer than bulk conversion, so bulk conversion status is checked late.
+    // The delay must not be learned as conversion time
+    const auto busDir = test_sensor_root_dir + "2_buses/w1_bus_master2";
+    auto conversionTime = m.GetBusConversionTime(busDir);
+    ASSERT_NE(conversionTime.count(), 0);
+    backend->Delay = std::chrono::milliseconds(800);
+    setStatus("0");
+    std::thread slowConverter([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        setStatus("1");
+    });
+    start = std::chrono::steady_clock::now();
+    res = m.RescanBusAndRead();
+    slowConverter.join();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_EQ(m.GetBusConversionTime(busDir), conversionTime);
+    EXPECT_EQ(to_string(res[0]->GetTemperature()), "26.312000");
+    EXPECT_LE(res[0]->GetSampleTime(), start + conversionTime + std::chrono::milliseconds(100));
+    EXPECT_EQ(to_string(res[1]->GetTemperature()), "26.312000");
+    EXPECT_GE(res[1]->GetSampleTime(), start + std::chrono::milliseconds(800));
+}
+
+TEST_F(TSysfsOnewireManagerTest, synchronized_conversion_without_batch_read)
+{
+    // Sequential w1_slave reads are not done by the start step
+    auto backend = make_shared<TSlowDirectReadBackend>();
+    backend->Delay = std::chrono::milliseconds(800);
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error, nullptr, backend);
+    m.SetSynchronizedConversion(true);
+    auto start = std::chrono::steady_clock::now();
+    m.StartRescan();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+    EXPECT_LT(m.GetTriggerSkew(), std::chrono::milliseconds(100));
+
+    std::chrono::steady_clock::time_point nextCheck;
+    while (!m.CheckConversions(nextCheck)) {
+        std::this_thread::sleep_until(nextCheck);
+    }
+    const auto& res = m.CompleteRead();
+    ASSERT_EQ(res.size(), 2);
+    EXPECT_FALSE(res[1]->IsBulkRead());
+    EXPECT_EQ(to_string(res[1]->GetTemperature()), "26.312000");
+    EXPECT_GE(res[1]->GetSampleTime(), start + std::chrono::milliseconds(800));
+}
@@ -0,0 +1,182 @@
+#include "cancellation_token.h"
+#include "sysfs_w1.h"
+#include "threaded_runner.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+#include <wblib/testing/testlog.h>
+#include <wblib/utils.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace WBMQTT;
+using namespace WBMQTT::Testing;
+
+namespace
+{
+    class TCountingWorker: public IPeriodicalWorker
+    {
+    public:
+        TCountingWorker(mutex& m, condition_variable& cv, int& counter): Mutex(m), CV(cv), Counter(counter)
+        {}
+
+        void RunIteration() override
+        {
+            {
+                lock_guard<mutex> lg(Mutex);
+                ++Counter;
+            }
+            CV.notify_all();
+        }
+
+        void SetWakeUpHandler(function<void()> wakeUp) override
+        {
+            lock_guard<mutex> lg(Mutex);
+            WakeUp = wakeUp;
+        }
+
+        function<void()> WakeUp;
+
+    private:
+        mutex& Mutex;
+        condition_variable& CV;
+        int& Counter;
+    };
+
+    class TBlockingWorker: public TCountingWorker
+    {
+    public:
+        using TCountingWorker::TCountingWorker;
+
+        void RunIteration() override
+        {
+            TCountingWorker::RunIteration();
+            StopToken.WaitUntil(steady_clock::now() + seconds(10));
+        }
+
+        void Cancel() override
+        {
+            StopToken.Cancel();
+        }
+
+    private:
+        TCancellationToken StopToken;
+    };
+
+    // Reads w1_slave entries with a delay like a thermometer converting during the read
+    class TSlowDirectReadBackend: public TPlainSysfsBackend
+    {
+    public:
+        bool ReadFile(const string& path, string& content) override
+        {
+            if (StringHasSuffix(path, "/w1_slave")) {
+                this_thread::sleep_for(seconds(1));
+            }
+            return TPlainSysfsBackend::ReadFile(path, content);
+        }
+    };
+
+    // Reads all thermometers like TOneWireDriverWorker does
+    class TManagerWorker: public TCountingWorker
+    {
+    public:
+        TManagerWorker(mutex& m, condition_variable& cv, int& counter, const string& devicesDir, TLogger& logger)
+            : TCountingWorker(m, cv, counter),
+              Manager(devicesDir, logger, logger, &StopToken, make_shared<TSlowDirectReadBackend>())
+        {
+            Manager.SetBatchRead(true);
+        }
+
+        void RunIteration() override
+        {
+            TCountingWorker::RunIteration();
+            for (const auto& device: Manager.RescanBusAndRead()) {
+                if (StopToken.IsCancelled()) {
+                    return;
+                }
+                try {
+                    device->GetTemperature();
+                } catch (const exception&) {
+                }
+            }
+        }
+
+        void Cancel() override
+        {
+            StopToken.Cancel();
+        }
+
+    private:
+        TCancellationToken StopToken;
+        TSysfsOneWireManager Manager;
+    };
+}
+
+class TThreadedPeriodicalRunnerTest: public TLoggedFixture
+{
+protected:
+    mutex Mutex;
+    condition_variable CV;
+    int Counter = 0;
+
+    bool WaitForCounter(int value)
+    {
+        unique_lock<mutex> lk(Mutex);
+        return CV.wait_for(lk, seconds(5), [&] { return Counter >= value; });
+    }
+};
+
+TEST_F(TThreadedPeriodicalRunnerTest, wake_up)
+{
+    auto worker = new TCountingWorker(Mutex, CV, Counter);
+    TThreadedPeriodicalRunner runner(unique_ptr<IPeriodicalWorker>(worker), hours(1), "test", Debug);
+    ASSERT_TRUE(WaitForCounter(1));
+    function<void()> wakeUp;
+    {
+        lock_guard<mutex> lg(Mutex);
+        wakeUp = worker->WakeUp;
+    }
+    ASSERT_TRUE(!!wakeUp);
+    wakeUp();
+    EXPECT_TRUE(WaitForCounter(2));
+}
+
+TEST_F(TThreadedPeriodicalRunnerTest, shutdown_latency)
+{
+    auto runner = make_unique<TThreadedPeriodicalRunner>(
+        unique_ptr<IPeriodicalWorker>(new TBlockingWorker(Mutex, CV, Counter)),
+        hours(1),
+        "test",
+        Debug);
+    ASSERT_TRUE(WaitForCounter(1));
+
+    auto start = steady_clock::now();
+    runner.reset();
+    auto shutdownTime = duration_cast<milliseconds>(steady_clock::now() - start);
+    EXPECT_LT(shutdownTime.count(), 500);
+}
+
+TEST_F(TThreadedPeriodicalRunnerTest, manager_shutdown_latency)
+{
+    string devicesDir = getenv("TEST_DIR_ABS") ? getenv("TEST_DIR_ABS") : ".";
+    devicesDir += "/fake_sensors/2_buses/";
+
+    // Bulk conversion never completes, so the worker waits for it when the runner is stopped
+    {
+        ofstream f(devicesDir + "w1_bus_master2/therm_bulk_read", ofstream::trunc);
+        f << "0";
+    }
+    auto runner = make_unique<TThreadedPeriodicalRunner>(
+        unique_ptr<IPeriodicalWorker>(new TManagerWorker(Mutex, CV, Counter, devicesDir, Debug)),
+        hours(1),
+        "test",
+        Debug);
+    ASSERT_TRUE(WaitForCounter(1));
+    this_thread::sleep_for(milliseconds(100));
+
+    // Batch reading of w1_slave entries after cancelled wait takes 1 s
+    auto start = steady_clock::now();
+    runner.reset();
+    auto shutdownTime = duration_cast<milliseconds>(steady_clock::now() - start);
+    EXPECT_LT(shutdownTime.count(), 500);
+}
@@ -0,0 +1,46 @@
+#include "threshold_alarm.h"
+#include <gtest/gtest.h>
+
+TEST(TThresholdAlarmTest, high_limit_with_hysteresis)
+{
+    TThresholds thresholds;
+    thresholds.High = 60;
+    thresholds.Hysteresis = 1;
+    TThresholdAlarm alarm(thresholds);
+
+    EXPECT_FALSE(alarm.Update(59.5));
+    EXPECT_FALSE(alarm.IsActive());
+    EXPECT_FALSE(alarm.Update(60));
+    EXPECT_TRUE(alarm.Update(60.5));
+    EXPECT_TRUE(alarm.IsActive());
+
+    // Still inside hysteresis band
+    EXPECT_FALSE(alarm.Update(59.5));
+    EXPECT_TRUE(alarm.IsActive());
+
+    EXPECT_TRUE(alarm.Update(58.9));
+    EXPECT_FALSE(alarm.IsActive());
+}
+
+TEST(TThresholdAlarmTest, low_limit)
+{
+    TThresholds thresholds;
+    thresholds.Low = -10;
+    thresholds.Hysteresis = 0.5;
+    TThresholdAlarm alarm(thresholds);
+
+    EXPECT_FALSE(alarm.Update(100));
+    EXPECT_TRUE(alarm.Update(-10.5));
+    EXPECT_FALSE(alarm.Update(-9.8));
+    EXPECT_TRUE(alarm.IsActive());
+    EXPECT_TRUE(alarm.Update(-9.5));
+    EXPECT_FALSE(alarm.IsActive());
+}
+
+TEST(TThresholdAlarmTest, no_limits)
+{
+    TThresholdAlarm alarm(TThresholds{});
+    EXPECT_FALSE(alarm.Update(-1000));
+    EXPECT_FALSE(alarm.Update(1000));
+    EXPECT_FALSE(alarm.IsActive());
+}
@@ -0,0 +1,70 @@
+#include "window_statistics.h"
+#include <gtest/gtest.h>
+
+TEST(TWindowStatisticsTest, disabled)
+{
+    TWindowStatistics s;
+    EXPECT_FALSE(s.IsEnabled());
+    s.AddSample(1.0);
+    EXPECT_FALSE(s.IsReportDue());
+    EXPECT_EQ(s.GetCount(), 0);
+}
+
+TEST(TWindowStatisticsTest, min_max_mean)
+{
+    TWindowStatistics s(3);
+    s.AddSample(20.0);
+    s.AddSample(22.0);
+    EXPECT_FALSE(s.IsReportDue());
+    s.AddSample(21.0);
+    EXPECT_TRUE(s.IsReportDue());
+    EXPECT_EQ(s.GetCount(), 3);
+    EXPECT_DOUBLE_EQ(s.GetMin(), 20.0);
+    EXPECT_DOUBLE_EQ(s.GetMax(), 22.0);
+    EXPECT_DOUBLE_EQ(s.GetMean(), 21.0);
+
+    s.MarkReported();
+    EXPECT_FALSE(s.IsReportDue());
+
+    // 20.0 and 22.0 leave the window
+    s.AddSample(25.0);
+    s.AddSample(23.0);
+    EXPECT_EQ(s.GetCount(), 3);
+    EXPECT_DOUBLE_EQ(s.GetMin(), 21.0);
+    EXPECT_DOUBLE_EQ(s.GetMax(), 25.0);
+    EXPECT_DOUBLE_EQ(s.GetMean(), 23.0);
+}
+
+TEST(TWindowStatisticsTest, missing_samples)
+{
+    TWindowStatistics s(3);
+    s.AddSample(10.0);
+    s.AddSample(std::nullopt);
+    s.AddSample(30.0);
+    EXPECT_EQ(s.GetCount(), 2);
+    EXPECT_DOUBLE_EQ(s.GetMin(), 10.0);
+    EXPECT_DOUBLE_EQ(s.GetMax(), 30.0);
+    EXPECT_DOUBLE_EQ(s.GetMean(), 20.0);
+
+    s.AddSample(std::nullopt);
+    EXPECT_EQ(s.GetCount(), 1);
+    EXPECT_DOUBLE_EQ(s.GetMin(), 30.0);
+    EXPECT_DOUBLE_EQ(s.GetMax(), 30.0);
+
+    s.AddSample(std::nullopt);
+    s.AddSample(std::nullopt);
+    EXPECT_EQ(s.GetCount(), 0);
+}
+
+TEST(TWindowStatisticsTest, reset)
+{
+    TWindowStatistics s(2);
+    s.AddSample(1.0);
+    s.AddSample(2.0);
+    s.Reset(4);
+    EXPECT_EQ(s.GetCount(), 0);
+    EXPECT_FALSE(s.IsReportDue());
+    s.AddSample(5.0);
+    EXPECT_DOUBLE_EQ(s.GetMin(), 5.0);
+    EXPECT_DOUBLE_EQ(s.GetMax(), 5.0);
+}
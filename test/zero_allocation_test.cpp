@@ -0,0 +1,322 @@
+#include "log_limiter.h"
+#include "onewire_driver.h"
+#include "sysfs_io_uring.h"
+#include "sysfs_w1.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <wblib/driver_args.h>
+#include <wblib/testing/fake_driver.h>
+#include <wblib/testing/fake_mqtt.h>
+#include <wblib/testing/testlog.h>
+
+using namespace std;
+using namespace WBMQTT;
+using namespace WBMQTT::Testing;
+
+// Counting global allocator, it counts allocations only while CountAllocations is set
+namespace
+{
+    atomic<bool> CountAllocations{false};
+    atomic<size_t> Allocations{0};
+
+    void* Allocate(size_t size, size_t alignment = alignof(max_align_t))
+    {
+        if (CountAllocations) {
+            ++Allocations;
+        }
+        if (size == 0) {
+            size = 1;
+        }
+        void* p = nullptr;
+        if (alignment <= alignof(max_align_t)) {
+            p = malloc(size);
+        } else if (posix_memalign(&p, alignment, size) != 0) {
+            p = nullptr;
+        }
+        return p;
+    }
+
+    void* AllocateOrThrow(size_t size, size_t alignment = alignof(max_align_t))
+    {
+        auto p = Allocate(size, alignment);
+        if (!p) {
+            throw bad_alloc();
+        }
+        return p;
+    }
+
+    //! Log of MQTT traffic, it isn't compared with anything
+    class TQuietLog: public TLoggedFixture
+    {
+        void TestBody() override
+        {}
+    };
+}
+
+void* operator new(size_t size)
+{
+    return AllocateOrThrow(size);
+}
+
+void* operator new[](size_t size)
+{
+    return AllocateOrThrow(size);
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+class TZeroAllocationTest: public TLoggedFixture
+{
+protected:
+    string test_sensor_root_dir;
+    string BulkReadFile;
+    string BulkReadContent;
+
+    void SetUp()
+    {
+        char* d = getenv("TEST_DIR_ABS");
+        if (d != NULL) {
+            test_sensor_root_dir = d;
+            test_sensor_root_dir += '/';
+        }
+        test_sensor_root_dir += "fake_sensors/";
+
+        BulkReadFile = test_sensor_root_dir + "2_buses/w1_bus_master2/therm_bulk_read";
+        stringstream original;
+        original << ifstream(BulkReadFile).rdbuf();
+        BulkReadContent = original.str();
+
+        // Conversion is completed
+        ofstream f(BulkReadFile, ofstream::trunc);
+        f << "1";
+    }
+
+    void TearDown()
+    {
+        // Bulk conversion triggers are written to the file
+        ofstream(BulkReadFile, ofstream::trunc) << BulkReadContent;
+    }
+
+    // Discovery, bulk conversion and reading of all thermometers
+    void RunCycle(TSysfsOneWireManager& manager)
+    {
+        for (const auto& device: manager.RescanBusAndRead()) {
+            device->GetTemperature();
+        }
+    }
+
+    size_t CountCycleAllocations(TSysfsOneWireManager& manager)
+    {
+        // Buffers grow during first cycles
+        for (int i = 0; i < 3; ++i) {
+            RunCycle(manager);
+        }
+        Allocations = 0;
+        CountAllocations = true;
+        RunCycle(manager);
+        CountAllocations = false;
+        return Allocations;
+    }
+
+    //! Complete full scan of the worker
+    void RunDriverCycle(TOneWireDriverWorker& worker)
+    {
+        // Zero polling interval makes next iteration a full scan
+        worker.GetNextIterationDelay(chrono::milliseconds::zero());
+        const auto pollInterval = chrono::hours(1);
+        worker.RunIteration();
+        for (int i = 0; i < 100 && worker.GetNextIterationDelay(pollInterval) < chrono::minutes(59); ++i) {
+            this_thread::sleep_for(worker.GetNextIterationDelay(pollInterval));
+            worker.RunIteration();
+        }
+    }
+};
+
+TEST_F(TZeroAllocationTest, steady_state_cycle)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    EXPECT_EQ(CountCycleAllocations(m), 0);
+}
+
+TEST_F(TZeroAllocationTest, master_slaves_list)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("kernel_search/"), Debug, Error);
+    EXPECT_EQ(CountCycleAllocations(m), 0);
+}
+
+TEST_F(TZeroAllocationTest, mixed_bus)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("mixed_bus/"), Debug, Error);
+    EXPECT_EQ(CountCycleAllocations(m), 0);
+}
+
+TEST_F(TZeroAllocationTest, batch_read)
+{
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error);
+    m.SetBatchRead(true);
+    EXPECT_EQ(CountCycleAllocations(m), 0);
+}
+
+TEST_F(TZeroAllocationTest, io_uring_batch_read)
+{
+    PSysfsBackend backend;
+    try {
+        backend = make_shared<TIoUringSysfsBackend>();
+    } catch (const exception& e) {
+        GTEST_SKIP() << e.what();
+    }
+    auto m = TSysfsOneWireManager(test_sensor_root_dir + string("2_buses/"), Debug, Error, nullptr, backend);
+    m.SetBatchRead(true);
+    EXPECT_EQ(CountCycleAllocations(m), 0);
+}
+
+// MQTT publications always allocate in wblib, so the driver must not allocate more than the same publications
+TEST_F(TZeroAllocationTest, driver_cycle)
+{
+    const string deviceId = "wb-w1";
+    const vector<string> sensors = {"28-00000a013d97", "28-00000a013000"};
+    TQuietLog mqttLog;
+    auto broker = NewFakeMqttBroker(mqttLog);
+    auto driver = NewDriver(TDriverArgs{}
+                                .SetId("zero-allocation-test")
+                                .SetBackend(NewDriverBackend(broker->MakeClient("zero-allocation-test")))
+                                .SetIsTesting(true)
+                                .SetReownUnknownDevices(true)
+                                .SetUseStorage(false));
+    driver->StartLoop();
+    {
+        TOneWireDriverSettings settings;
+        settings.SampleTimes = true;
+        settings.AggregationWindow = 1;
+        TOneWireDriverWorker worker(deviceId, driver, Info, Debug, Error, test_sensor_root_dir + "2_buses/", settings);
+
+        // Controls are created and buffers grow during first cycles
+        for (int i = 0; i < 3; ++i) {
+            RunDriverCycle(worker);
+        }
+        Allocations = 0;
+        CountAllocations = true;
+        RunDriverCycle(worker);
+        CountAllocations = false;
+        auto cycleAllocations = Allocations.load();
+
+        auto device = driver->BeginTx()->GetDevice(deviceId);
+        ASSERT_TRUE(device);
+        vector<pair<PControl, double>> values;
+        vector<pair<PControl, string>> rawValues;
+        for (const auto& sensor: sensors) {
+            for (const auto& suffix: {"", "_min", "_max", "_mean", "_count"}) {
+                auto control = device->GetControl(sensor + suffix);
+                ASSERT_TRUE(control) << sensor + suffix;
+                values.emplace_back(control, stod(control->GetRawValue()));
+            }
+            for (const auto& suffix: {"_sample_time", "_latency"}) {
+                auto control = device->GetControl(sensor + suffix);
+                ASSERT_TRUE(control) << sensor + suffix;
+                rawValues.emplace_back(control, control->GetRawValue());
+            }
+        }
+        Allocations = 0;
+        CountAllocations = true;
+        {
+            auto tx = driver->BeginTx();
+            for (const auto& value: values) {
+                device->GetControl(value.first->GetId())->SetValue(tx, value.second).Sync();
+            }
+            for (const auto& value: rawValues) {
+                device->GetControl(value.first->GetId())->SetRawValue(tx, value.second).Sync();
+            }
+        }
+        CountAllocations = false;
+        EXPECT_LE(cycleAllocations, Allocations.load());
+    }
+    driver->StopLoop();
+}
+
+TEST_F(TZeroAllocationTest, repeated_error_log)
+{
+    // Identifier is longer than short string buffer, so a copy of it would allocate
+    const string source = "28-00000a013000-wrong-crc";
+    TLogRateLimiter limiter(chrono::seconds(60));
+    auto now = chrono::steady_clock::now();
+    EXPECT_TRUE(limiter.Report(source, 1, now));
+
+    Allocations = 0;
+    CountAllocations = true;
+    auto logged = limiter.Report(source, 1, now + chrono::seconds(1));
+    CountAllocations = false;
+    EXPECT_FALSE(logged);
+    EXPECT_EQ(Allocations, 0);
+}
+
+TEST_F(TZeroAllocationTest, counter_works)
+{
+    CountAllocations = true;
+    auto p = make_unique<string>(100, 'a');
+    CountAllocations = false;
+    EXPECT_EQ(p->size(), 100);
+    EXPECT_GE(Allocations, 1);
+}
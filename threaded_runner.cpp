@@ -9,28 +9,44 @@ using namespace WBMQTT;
 IPeriodicalWorker::~IPeriodicalWorker()
 {}
 
+std::chrono::milliseconds IPeriodicalWorker::GetNextIterationDelay(std::chrono::milliseconds pollInterval)
+{
+    return pollInterval;
+}
+
+void IPeriodicalWorker::SetWakeUpHandler(std::function<void()> wakeUp)
+{}
+
+void IPeriodicalWorker::Cancel()
+{}
+
 TThreadedPeriodicalRunner::TThreadedPeriodicalRunner(unique_ptr<IPeriodicalWorker> worker,
                                                      std::chrono::milliseconds pollInterval,
                                                      const string& threadName,
                                                      TLogger& logger)
     : Worker(move(worker)),
-      Active(false)
+      Active(false),
+      WakeUpRequested(false)
 {
     if (pollInterval.count() < 1) {
         throw invalid_argument("polling intervall must be greater than zero");
     }
 
+    Worker->SetWakeUpHandler([this] { WakeUp(); });
     Active = true;
     WorkerThread = MakeThread(threadName, {[this, pollInterval, threadName, &logger] {
                                   logger.Log() << threadName << " Started";
 
                                   while (1) {
                                       Worker->RunIteration();
+                                      auto delay = Worker->GetNextIterationDelay(pollInterval);
 
                                       unique_lock<mutex> lk(ActiveMutex);
-                                      if (ActiveCV.wait_for(lk, pollInterval, [&] { return !Active; })) {
+                                      ActiveCV.wait_for(lk, delay, [&] { return !Active || WakeUpRequested; });
+                                      if (!Active) {
                                           break;
                                       }
+                                      WakeUpRequested = false;
                                   }
                                   logger.Log() << threadName << " Stopped";
                               }});
@@ -45,6 +61,7 @@ TThreadedPeriodicalRunner::~TThreadedPeriodicalRunner()
         }
         Active = false;
     }
+    Worker->Cancel();
     ActiveCV.notify_one();
 
     if (WorkerThread->joinable()) {
@@ -52,4 +69,16 @@ TThreadedPeriodicalRunner::~TThreadedPeriodicalRunner()
     }
 
     WorkerThread.reset();
+
+    // The worker can call WakeUp until it is destroyed
+    Worker.reset();
+}
+
+void TThreadedPeriodicalRunner::WakeUp()
+{
+    {
+        lock_guard<mutex> lock(ActiveMutex);
+        WakeUpRequested = true;
+    }
+    ActiveCV.notify_one();
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <wblib/log.h>
 
 /**
@@ -13,10 +15,34 @@ public:
     virtual ~IPeriodicalWorker();
 
     /**
-     * @brief The method is called by TThreadedPeriodicalRunner periodically
+     * @brief The method is called by TThreadedPeriodicalRunner periodically.
+     *        An iteration can be split into several calls: the worker returns while it waits for something
+     *        and GetNextIterationDelay returns time left until the wait is over.
      *
      */
     virtual void RunIteration() = 0;
+
+    /**
+     * @brief The method is called by TThreadedPeriodicalRunner after every RunIteration call
+     *
+     * @param pollInterval polling interval set in TThreadedPeriodicalRunner
+     * @return std::chrono::milliseconds delay before next RunIteration call, pollInterval by default
+     */
+    virtual std::chrono::milliseconds GetNextIterationDelay(std::chrono::milliseconds pollInterval);
+
+    /**
+     * @brief The method is called by TThreadedPeriodicalRunner before first RunIteration call.
+     *        The worker can call wakeUp from any thread to get RunIteration called without waiting for the delay.
+     *
+     * @param wakeUp function to request immediate RunIteration call
+     */
+    virtual void SetWakeUpHandler(std::function<void()> wakeUp);
+
+    /**
+     * @brief The method is called by TThreadedPeriodicalRunner from another thread on stop.
+     *        Current RunIteration call should return as soon as possible.
+     */
+    virtual void Cancel();
 };
 
 /**
@@ -42,8 +68,11 @@ public:
     ~TThreadedPeriodicalRunner();
 
 private:
+    void WakeUp();
+
     std::unique_ptr<IPeriodicalWorker> Worker;
     bool Active;
+    bool WakeUpRequested;
     std::mutex ActiveMutex;
     std::condition_variable ActiveCV;
     std::unique_ptr<std::thread> WorkerThread;
@@ -0,0 +1,30 @@
+#include "threshold_alarm.h"
+
+TThresholdAlarm::TThresholdAlarm(const TThresholds& thresholds): Thresholds(thresholds), Active(false)
+{}
+
+bool TThresholdAlarm::Update(double value)
+{
+    bool active;
+    if (Active) {
+        active = (Thresholds.Low && value < *Thresholds.Low + Thresholds.Hysteresis) ||
+                 (Thresholds.High && value > *Thresholds.High - Thresholds.Hysteresis);
+    } else {
+        active = (Thresholds.Low && value < *Thresholds.Low) || (Thresholds.High && value > *Thresholds.High);
+    }
+    if (active == Active) {
+        return false;
+    }
+    Active = active;
+    return true;
+}
+
+bool TThresholdAlarm::IsActive() const
+{
+    return Active;
+}
+
+const TThresholds& TThresholdAlarm::GetThresholds() const
+{
+    return Thresholds;
+}
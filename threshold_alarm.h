@@ -0,0 +1,49 @@
+#pragma once
+
+#include <optional>
+
+/**
+ * @brief Alarm limits of a value
+ *
+ */
+struct TThresholds
+{
+    //! Low limit, std::nullopt - not set
+    std::optional<double> Low;
+
+    //! High limit, std::nullopt - not set
+    std::optional<double> High;
+
+    /**
+     * @brief The alarm is cleared when the value returns inside [Low + Hysteresis, High - Hysteresis] band
+     */
+    double Hysteresis = 0;
+
+    bool operator==(const TThresholds&) const = default;
+};
+
+/**
+ * @brief The class tracks alarm state of a value according to TThresholds
+ *
+ */
+class TThresholdAlarm
+{
+public:
+    explicit TThresholdAlarm(const TThresholds& thresholds);
+
+    /**
+     * @brief Evaluate new value
+     *
+     * @return true - alarm state is changed
+     * @return false - alarm state is the same
+     */
+    bool Update(double value);
+
+    bool IsActive() const;
+
+    const TThresholds& GetThresholds() const;
+
+private:
+    TThresholds Thresholds;
+    bool Active;
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+/**
+ * Shared memory segment with latest readings of wb-mqtt-w1 thermometers, see -M option of wb-mqtt-w1.
+ * The header has no dependencies besides the standard library and POSIX, so local consumers
+ * can read the segment without linking to the driver or MQTT libraries.
+ *
+ * Layout, version 2. Fields are in native byte order, offsets are in bytes.
+ *
+ *   Header, 64 bytes at offset 0:
+ *     0   uint32   magic, W1_SHM_MAGIC
+ *     4   uint32   layout version, W1_SHM_VERSION
+ *     8   uint32   record size, 64
+ *     12  uint32   capacity, maximum number of records
+ *     16  uint32   count, number of initialized records. It only grows, records are never moved
+ *     20  -        reserved
+ *
+ *   Records, 64 bytes each at offset 64 + index * 64:
+ *     0   uint32   sequence, seqlock counter. It is odd while the record is being written
+ *     4   uint32   status, TW1ShmStatus
+ *     8   char[24] thermometer's identifier code, e.g. 28-00000a013d97, zero padded
+ *     32  double   temperature, Celsius degrees
+ *     40  int64    timestamp, Unix time in ms. Conversion completion time of the value,
+ *                  or detection time for read errors and disconnection
+ *     48  -        reserved
+ *
+ * The segment is written by one process. A reader loads the sequence, copies status, identifier code, temperature
+ * and timestamp, and loads the sequence again. The copy is consistent if both loads return the same even number.
+ * Readers never write to the segment and never block the writer. Fields covered by the sequence are accessed
+ * as 32-bit atomic words, so a read-only mapping is enough on every architecture.
+ *
+ * When all records are initialized, a record of a new thermometer replaces the record of the thermometer
+ * which is disconnected for the longest time, i.e. a record with W1_SHM_DISCONNECTED status can get another
+ * identifier code. A reader with a cached record index checks the identifier code of every copy.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//! "W1SM" in little endian byte order
+const uint32_t W1_SHM_MAGIC = 0x4d533157;
+const uint32_t W1_SHM_VERSION = 2;
+const size_t W1_SHM_ID_SIZE = 24;
+
+enum TW1ShmStatus : uint32_t
+{
+    W1_SHM_NO_VALUE = 0,    // the thermometer is found, but no value is read yet
+    W1_SHM_OK = 1,          // temperature holds last read value
+    W1_SHM_READ_ERROR = 2,  // last read failed, temperature holds last successfully read value
+    W1_SHM_DISCONNECTED = 3 // the thermometer is disconnected, the record can be reused for another thermometer
+};
+
+struct TW1ShmHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t RecordSize;
+    uint32_t Capacity;
+    std::atomic<uint32_t> Count;
+    uint32_t Reserved[11];
+};
+
+struct TW1ShmRecord
+{
+    std::atomic<uint32_t> Sequence;
+    std::atomic<uint32_t> Status;
+    std::atomic<uint32_t> Id[W1_SHM_ID_SIZE / sizeof(uint32_t)];
+    std::atomic<uint32_t> Temperature[2];
+    std::atomic<uint32_t> Timestamp[2];
+    uint32_t Reserved[4];
+};
+
+static_assert(sizeof(TW1ShmHeader) == 64, "shared memory header layout is fixed");
+static_assert(sizeof(TW1ShmRecord) == 64, "shared memory record layout is fixed");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory requires lock-free 32-bit atomics");
+
+/**
+ * @brief Consistent copy of a record
+ */
+struct TW1ShmReading
+{
+    TW1ShmStatus Status = W1_SHM_NO_VALUE;
+    double Temperature = 0;
+    int64_t Timestamp = 0;
+    char Id[W1_SHM_ID_SIZE] = {};
+
+    //! Thermometer's identifier code
+    std::string_view GetId() const
+    {
+        return std::string_view(Id, strnlen(Id, W1_SHM_ID_SIZE));
+    }
+};
+
+/**
+ * @brief Read-only view of the shared memory segment. All methods are wait-free.
+ *
+ */
+class TW1ShmReader
+{
+public:
+    /**
+     * @brief Map the segment. Throws std::system_error if the file can't be mapped
+     *        and std::runtime_error if it has unsupported layout.
+     *
+     * @param path segment file, e.g. /dev/shm/wb-mqtt-w1
+     */
+    explicit TW1ShmReader(const std::string& path): Data(nullptr), Size(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            auto error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "can't stat " + path);
+        }
+        Size = st.st_size;
+        if (Size < sizeof(TW1ShmHeader)) {
+            close(fd);
+            throw std::runtime_error(path + " is too small");
+        }
+        Data = mmap(nullptr, Size, PROT_READ, MAP_SHARED, fd, 0);
+        auto error = errno;
+        close(fd);
+        if (Data == MAP_FAILED) {
+            Data = nullptr;
+            throw std::system_error(error, std::generic_category(), "can't map " + path);
+        }
+        const auto& header = GetHeader();
+        if (header.Magic != W1_SHM_MAGIC || header.Version != W1_SHM_VERSION ||
+            header.RecordSize != sizeof(TW1ShmRecord) ||
+            Size < sizeof(TW1ShmHeader) + header.Capacity * sizeof(TW1ShmRecord))
+        {
+            munmap(Data, Size);
+            throw std::runtime_error(path + " has unsupported layout");
+        }
+    }
+
+    ~TW1ShmReader()
+    {
+        if (Data) {
+            munmap(Data, Size);
+        }
+    }
+
+    TW1ShmReader(const TW1ShmReader&) = delete;
+    TW1ShmReader& operator=(const TW1ShmReader&) = delete;
+
+    /**
+     * @brief Get number of records. Records of new thermometers are appended while there is free space,
+     *        then records of disconnected thermometers are reused. Indexes of connected thermometers don't change
+     */
+    size_t GetCount() const
+    {
+        return GetHeader().Count.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Get identifier code of a thermometer
+     *
+     * @param index record index, less than GetCount
+     * @return empty string if the record was being written during all attempts
+     */
+    std::string GetId(size_t index) const
+    {
+        TW1ShmReading reading;
+        if (!Read(index, reading)) {
+            return std::string();
+        }
+        return std::string(reading.GetId());
+    }
+
+    /**
+     * @brief Find record index of a thermometer. The search is linear, so the index is better to be cached.
+     *        The record can be reused after the thermometer's disconnection, so Id of a reading from cached index
+     *        must be compared with the thermometer's identifier code
+     */
+    std::optional<size_t> Find(std::string_view id) const
+    {
+        auto count = GetCount();
+        for (size_t i = 0; i < count; ++i) {
+            if (GetId(i) == id) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Make single attempt to copy a record
+     *
+     * @param index record index, less than GetCount
+     * @return false - the record is being written, reading is not changed
+     */
+    bool TryRead(size_t index, TW1ShmReading& reading) const
+    {
+        const auto& record = GetRecord(index);
+        auto sequence = record.Sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            return false;
+        }
+        auto status = record.Status.load(std::memory_order_relaxed);
+        uint32_t id[W1_SHM_ID_SIZE / sizeof(uint32_t)];
+        for (size_t i = 0; i < W1_SHM_ID_SIZE / sizeof(uint32_t); ++i) {
+            id[i] = record.Id[i].load(std::memory_order_relaxed);
+        }
+        uint32_t temperature[2] = {record.Temperature[0].load(std::memory_order_relaxed),
+                                   record.Temperature[1].load(std::memory_order_relaxed)};
+        uint32_t timestamp[2] = {record.Timestamp[0].load(std::memory_order_relaxed),
+                                 record.Timestamp[1].load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.Sequence.load(std::memory_order_relaxed) != sequence) {
+            return false;
+        }
+        reading.Status = static_cast<TW1ShmStatus>(status);
+        memcpy(&reading.Temperature, temperature, sizeof(reading.Temperature));
+        memcpy(&reading.Timestamp, timestamp, sizeof(reading.Timestamp));
+        memcpy(reading.Id, id, sizeof(reading.Id));
+        return true;
+    }
+
+    /**
+     * @brief Copy a record making up to maxAttempts attempts. The writer updates a record once per polling cycle,
+     *        so a retry almost always succeeds.
+     *
+     * @return false - the record was being written during all attempts, reading is not changed
+     */
+    bool Read(size_t index, TW1ShmReading& reading, size_t maxAttempts = 16) const
+    {
+        for (size_t i = 0; i < maxAttempts; ++i) {
+            if (TryRead(index, reading)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const TW1ShmHeader& GetHeader() const
+    {
+        return *static_cast<const TW1ShmHeader*>(Data);
+    }
+
+    const TW1ShmRecord& GetRecord(size_t index) const
+    {
+        auto records = reinterpret_cast<const TW1ShmRecord*>(static_cast<const char*>(Data) + sizeof(TW1ShmHeader));
+        return records[index];
+    }
+
+    void* Data;
+    size_t Size;
+};
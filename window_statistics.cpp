@@ -0,0 +1,97 @@
+#include "window_statistics.h"
+
+TWindowStatistics::TWindowStatistics(size_t windowSize)
+{
+    Reset(windowSize);
+}
+
+void TWindowStatistics::Reset(size_t windowSize)
+{
+    Samples.Reset(windowSize);
+    MinWedge.Reset(windowSize);
+    MaxWedge.Reset(windowSize);
+    Tick = 0;
+    Count = 0;
+    Sum = 0;
+    CyclesSinceReport = 0;
+}
+
+bool TWindowStatistics::IsEnabled() const
+{
+    return Samples.GetCapacity() != 0;
+}
+
+void TWindowStatistics::AddSample(std::optional<double> value)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+    ++Tick;
+    ++CyclesSinceReport;
+
+    if (Samples.IsFull()) {
+        if (Samples.Front()) {
+            Sum -= *Samples.Front();
+            --Count;
+        }
+        Samples.PopFront();
+    }
+    Samples.PushBack(value);
+
+    // Drop wedge entries which are out of the window
+    if (Tick > Samples.GetCapacity()) {
+        const auto windowStart = Tick - Samples.GetCapacity();
+        while (!MinWedge.IsEmpty() && MinWedge.Front().Tick <= windowStart) {
+            MinWedge.PopFront();
+        }
+        while (!MaxWedge.IsEmpty() && MaxWedge.Front().Tick <= windowStart) {
+            MaxWedge.PopFront();
+        }
+    }
+
+    if (!value) {
+        return;
+    }
+    Sum += *value;
+    ++Count;
+
+    while (!MinWedge.IsEmpty() && MinWedge.Back().Value >= *value) {
+        MinWedge.PopBack();
+    }
+    MinWedge.PushBack({Tick, *value});
+
+    while (!MaxWedge.IsEmpty() && MaxWedge.Back().Value <= *value) {
+        MaxWedge.PopBack();
+    }
+    MaxWedge.PushBack({Tick, *value});
+}
+
+bool TWindowStatistics::IsReportDue() const
+{
+    return IsEnabled() && CyclesSinceReport >= Samples.GetCapacity();
+}
+
+void TWindowStatistics::MarkReported()
+{
+    CyclesSinceReport = 0;
+}
+
+size_t TWindowStatistics::GetCount() const
+{
+    return Count;
+}
+
+double TWindowStatistics::GetMin() const
+{
+    return MinWedge.Front().Value;
+}
+
+double TWindowStatistics::GetMax() const
+{
+    return MaxWedge.Front().Value;
+}
+
+double TWindowStatistics::GetMean() const
+{
+    return Sum / Count;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/**
+ * @brief Fixed capacity ring buffer. All operations are O(1), memory is allocated only in constructor and Reset.
+ *
+ * @tparam T type of stored elements
+ */
+template<class T> class TRingBuffer
+{
+public:
+    explicit TRingBuffer(size_t capacity = 0): Buffer(capacity), Head(0), Size(0)
+    {}
+
+    /**
+     * @brief Drop all elements and change capacity of the buffer
+     */
+    void Reset(size_t capacity)
+    {
+        Buffer.assign(capacity, T());
+        Head = 0;
+        Size = 0;
+    }
+
+    size_t GetSize() const
+    {
+        return Size;
+    }
+
+    size_t GetCapacity() const
+    {
+        return Buffer.size();
+    }
+
+    bool IsEmpty() const
+    {
+        return Size == 0;
+    }
+
+    bool IsFull() const
+    {
+        return Size == Buffer.size();
+    }
+
+    /**
+     * @brief Append an element. The buffer must not be full.
+     */
+    void PushBack(const T& value)
+    {
+        Buffer[(Head + Size) % Buffer.size()] = value;
+        ++Size;
+    }
+
+    void PopFront()
+    {
+        Head = (Head + 1) % Buffer.size();
+        --Size;
+    }
+
+    void PopBack()
+    {
+        --Size;
+    }
+
+    const T& Front() const
+    {
+        return Buffer[Head];
+    }
+
+    const T& Back() const
+    {
+        return Buffer[(Head + Size - 1) % Buffer.size()];
+    }
+
+private:
+    std::vector<T> Buffer;
+    size_t Head;
+    size_t Size;
+};
+
+/**
+ * @brief Rolling window statistics (min, max, mean and number of valid samples) over last N polling cycles.
+ *        Min and max are tracked with monotonic wedges, so every update is O(1) amortized.
+ *
+ */
+class TWindowStatistics
+{
+public:
+    /**
+     * @brief Construct a new TWindowStatistics object
+     *
+     * @param windowSize number of polling cycles in the window, 0 - statistics is disabled
+     */
+    explicit TWindowStatistics(size_t windowSize = 0);
+
+    /**
+     * @brief Drop collected samples and set new window size
+     *
+     * @param windowSize number of polling cycles in the window, 0 - statistics is disabled
+     */
+    void Reset(size_t windowSize);
+
+    bool IsEnabled() const;
+
+    /**
+     * @brief Add result of a polling cycle to the window
+     *
+     * @param value read value, std::nullopt if the value can't be read
+     */
+    void AddSample(std::optional<double> value);
+
+    /**
+     * @brief Check if window size polling cycles have passed since last report
+     */
+    bool IsReportDue() const;
+
+    /**
+     * @brief Restart counting of polling cycles before next report
+     */
+    void MarkReported();
+
+    /**
+     * @brief Number of valid samples in the window
+     */
+    size_t GetCount() const;
+
+    /**
+     * @brief Get min, max and mean values. The functions must not be called if GetCount() returns 0.
+     */
+    double GetMin() const;
+    double GetMax() const;
+    double GetMean() const;
+
+private:
+    struct TEntry
+    {
+        uint64_t Tick = 0;
+        double Value = 0;
+    };
+
+    TRingBuffer<std::optional<double>> Samples;
+    TRingBuffer<TEntry> MinWedge;
+    TRingBuffer<TEntry> MaxWedge;
+    uint64_t Tick;
+    size_t Count;
+    double Sum;
+    size_t CyclesSinceReport;
+};